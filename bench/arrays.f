@@ -0,0 +1,9 @@
+\ ops: 1000 passes
+\ Reductions and updates over arrays of 10000 cells, with the bulk words
+10000 constant size
+create xs size allot
+create ys size allot
+xs size 3 fill ys size 2 fill
+: pass xs size sum xs ys size dot + 1 xs size a+! xs size max-of + drop ;
+: passes 1000 0 do pass loop ;
+passes xs size sum . cr
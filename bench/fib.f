@@ -0,0 +1,4 @@
+\ ops: 2692537 calls
+\ Doubly recursive Fibonacci, mostly calls and returns
+: fib dup 2 < if exit then dup 1 - recurse swap 2 - recurse + ;
+30 fib . cr
@@ -0,0 +1,9 @@
+# Generates a source with n numbers for the outer interpreter to parse
+BEGIN {
+    if(n == "") n = 200000
+    print "\\ ops: " n " numbers"
+    for(i = 0; i < n; i += 10) {
+        for(j = 0; j < 10; j++) printf "%d ", (i + j) * 7919 % 1000003
+        print "drop drop drop drop drop drop drop drop drop drop"
+    }
+}
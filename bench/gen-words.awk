@@ -0,0 +1,9 @@
+# Generates a source that defines n words, each compiling a call to the one
+# before it, to measure how fast the outer interpreter compiles
+BEGIN {
+    if(n == "") n = 50000
+    print "\\ ops: " n " words"
+    print ": w0 1 ;"
+    for(i = 1; i < n; i++)
+        printf ": w%d w%d %d + ;\n", i, i - 1, i
+}
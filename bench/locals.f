@@ -0,0 +1,5 @@
+\ ops: 3000000 calls
+\ Calls to a word that takes four cells, which it reads as locals
+: blend {: a b c d -- r :} a d * b c * + a - ;
+: run 0 3000000 0 do i 3 5 7 blend + loop ;
+run . cr
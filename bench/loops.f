@@ -0,0 +1,4 @@
+\ ops: 4000000 iterations
+\ Nested do loops, with a little arithmetic on the indices
+: nested 0 2000 0 do 2000 0 do i j + + loop loop ;
+nested . cr
@@ -0,0 +1,4 @@
+\ ops: 1000000 numbers
+\ Printing numbers, with the output going to /dev/null
+: numbers 1000000 0 do i . loop ;
+numbers cr
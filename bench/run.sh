@@ -0,0 +1,107 @@
+#!/bin/sh
+# Runs the benchmarks in this directory and prints their results as JSON.
+# Each one runs once to warm up and then BENCH_RUNS times, and its median
+# time, less the time the interpreter takes to start, is divided by the
+# work it does, declared on its first line as "\ ops: <count> <unit>".
+# Benchmarks more than BENCH_THRESHOLD percent slower per op than in the
+# baseline are flagged as regressions, which makes the script fail
+#
+# usage: bench/run.sh [bkf] [baseline]
+
+bkf=${1:-./bkf}
+baseline=${2:-bench/baseline.json}
+runs=${BENCH_RUNS:-5}
+threshold=${BENCH_THRESHOLD:-10}
+
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+[ -f "$baseline" ] || baseline=/dev/null
+
+# Sources too big to keep around are generated
+: > "$tmp/startup.f"
+awk -v n=50000 -f "$dir/gen-words.awk" > "$tmp/compile.f"
+awk -v n=200000 -f "$dir/gen-numbers.awk" > "$tmp/numbers.f"
+
+now() {
+    date +%s%N
+}
+
+# Appends "<name> <ops> <unit> <median ns>" to the results
+bench() {
+    name=$1
+    file=$2
+    set -- $(sed -n '1s/^\\ ops: //p' "$file")
+    ops=${1:-1}
+    unit=${2:-runs}
+    if ! "$bkf" -q < "$file" > /dev/null 2> "$tmp/errors" || [ -s "$tmp/errors" ]
+    then
+        echo "bench: $name failed:" >&2
+        cat "$tmp/errors" >&2
+        exit 2
+    fi
+    : > "$tmp/times"
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(now)
+        "$bkf" -q < "$file" > /dev/null 2>&1
+        end=$(now)
+        echo $((end - start)) >> "$tmp/times"
+        i=$((i + 1))
+    done
+    median=$(sort -n "$tmp/times" | awk '
+        { t[NR] = $1 }
+        END { print NR % 2 ? t[(NR + 1) / 2] : int((t[NR / 2] + t[NR / 2 + 1]) / 2) }')
+    echo "$name $ops $unit $median" >> "$tmp/results"
+}
+
+bench startup "$tmp/startup.f"
+for f in "$dir"/*.f; do
+    bench "$(basename "$f" .f)" "$f"
+done
+bench compile "$tmp/compile.f"
+bench numbers "$tmp/numbers.f"
+
+# The baseline is read back one benchmark per line, as written below
+awk -v threshold="$threshold" -v runs="$runs" -v baseline="$baseline" '
+    BEGIN {
+        while((getline line < baseline) > 0) {
+            if(!match(line, /"name": "[^"]*"/)) continue
+            name = substr(line, RSTART + 9, RLENGTH - 10)
+            if(match(line, /"ns_per_op": [0-9.]+/))
+                base[name] = substr(line, RSTART + 13, RLENGTH - 13) + 0
+        }
+    }
+    $1 == "startup" { startup = $4 }
+    {
+        ns = $1 == "startup" ? $4 : $4 - startup
+        if(ns < 0) ns = 0
+        line = sprintf("    { \"name\": \"%s\", \"unit\": \"%s\", \"ops\": %d, " \
+            "\"runs\": %d, \"median_ns\": %d, \"ns_per_op\": %.3f, " \
+            "\"ops_per_sec\": %.0f", $1, $3, $2, runs, $4, ns / $2,
+            ns > 0 ? $2 * 1e9 / ns : 0)
+        if($1 in base && base[$1] > 0) {
+            change = 100 * (ns / $2 - base[$1]) / base[$1]
+            regressed = change > threshold
+            if(regressed) {
+                regressions += 1
+                printf "bench: %s is %.1f%% slower than the baseline\n",
+                    $1, change > "/dev/stderr"
+            }
+            line = line sprintf(", \"baseline_ns_per_op\": %.3f, " \
+                "\"change_percent\": %.1f, \"regression\": %s",
+                base[$1], change, regressed ? "true" : "false")
+        }
+        lines[++count] = line " }"
+    }
+    END {
+        print "{"
+        print "  \"benchmarks\": ["
+        for(i = 1; i <= count; i++)
+            print lines[i] (i < count ? "," : "")
+        print "  ],"
+        printf "  \"regressions\": %d\n", regressions
+        print "}"
+        exit regressions > 0
+    }
+' "$tmp/results"
@@ -0,0 +1,18 @@
+\ ops: 100 sieves
+\ Sieve of Eratosthenes over 8190 cells, as in the classic BYTE benchmark
+8190 constant size
+create flags size allot
+: clear size 0 do -1 flags i cells+ ! loop ;
+: sieve
+    clear 0
+    size 0 do
+        flags i cells+ @ if
+            i dup + 3 + dup i +
+            begin dup size < while
+                0 over flags swap cells+ ! over +
+            repeat
+            drop drop 1 +
+        then
+    loop ;
+: sieves 0 100 0 do drop sieve loop ;
+sieves . cr
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2025 Eduardo Antunes dos Santos Vieira
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// The interpreter as a library, to be embedded in other programs. Each
+// processor is an interpreter of its own, with its own stacks and words.
+// The functions here don't return until the code they run is done, with
+// false if it ended with an error, which is reported on stderr first
+#ifndef BKF_H
+#define BKF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+# define BKF_NORETURN [[noreturn]]
+#else
+# define BKF_NORETURN _Noreturn
+#endif // __cplusplus
+
+#define BKF_VERSION "0.1"
+
+// Default capacity of the data stack, in cells
+#ifndef BKF_DS_SIZE
+# define BKF_DS_SIZE 4096
+#endif // BKF_DS_SIZE
+
+// Default size of the dictionary space, in cells
+#ifndef BKF_DICT_SIZE
+# define BKF_DICT_SIZE (1 << 20)
+#endif // BKF_DICT_SIZE
+
+// Default maximum nesting depth of colon word calls
+#ifndef BKF_RS_DEPTH
+# define BKF_RS_DEPTH 1024
+#endif // BKF_RS_DEPTH
+
+// Largest body, in cells, of a colon word inlined by default
+#ifndef BKF_INLINE_MAX
+# define BKF_INLINE_MAX 6
+#endif // BKF_INLINE_MAX
+
+// Default number of calls to a colon word before the JIT compiles it
+#ifndef BKF_JIT_THRESHOLD
+# define BKF_JIT_THRESHOLD 1000
+#endif // BKF_JIT_THRESHOLD
+
+typedef struct bkf_processor BkfProcessor;
+typedef struct bkf_word BkfWord;
+
+// Functions of code words, which take their arguments from the data stack
+// and leave their results there
+typedef void (*BkfCodeFn)(BkfProcessor *);
+
+typedef union bkf_value {
+    int32_t num;
+    char ch;
+    struct bkf_word *xt;  // execution token for a word
+    union bkf_value *addr; // address of a variable or instruction
+} BkfValue;
+
+// Settings of a new processor, where zero means the default
+typedef struct {
+    int ds_size, rs_size, dict_size; // capacities, in cells
+    int inline_max;         // largest colon word inlined unasked, in cells
+    uint32_t jit_threshold; // calls before the JIT compiles a word, if any
+    bool profile;    // time every word run?
+    bool trace;      // record the last instructions run?
+    bool unbuffered; // write output as soon as it is printed?
+    // The words are loaded from an image, if given, or else from a source
+    // file, like prelude.f. Without either, only the builtin ones exist
+    const char *image;
+    const char *prelude;
+} BkfConfig;
+
+// Makes a processor, with the defaults if config is NULL. Returns NULL if
+// the image couldn't be loaded
+BkfProcessor *bkf_new(const BkfConfig *config);
+// Waits for the workers spawned by the processor, and then frees it
+void bkf_free(BkfProcessor *p);
+
+// Whether this build can compile words to native code
+bool bkf_has_jit(void);
+
+// Run source code, from a string or read from a stream
+bool bkf_eval(BkfProcessor *p, const char *source);
+bool bkf_eval_stream(BkfProcessor *p, FILE *fp);
+
+// Looks a word up, or returns NULL. The word stays valid as long as the
+// processor, even if redefined, unless it is forgotten, so it can be looked
+// up once and then called directly, as often as needed
+BkfWord *bkf_find(BkfProcessor *p, const char *name);
+bool bkf_call(BkfProcessor *p, BkfWord *w);
+
+// The data stack. Push returns false if the stack is full, pop if it is
+// empty. Both can be used by code words as well
+bool bkf_push(BkfProcessor *p, BkfValue v);
+bool bkf_pop(BkfProcessor *p, BkfValue *v);
+int bkf_depth(BkfProcessor *p);
+
+// Defines a code word, whose name must last as long as the processor.
+// Code words run by the interpreter can end with an error by throwing
+BkfWord *bkf_register(BkfProcessor *p, const char *name, BkfCodeFn fn);
+BKF_NORETURN void bkf_throw(BkfProcessor *p, int code, const char *msg);
+
+// Output is buffered by the processor, including that of print
+void bkf_print(BkfProcessor *p, const char *text);
+void bkf_flush(BkfProcessor *p);
+
+// Lists the time taken by each word, if config->profile was set
+void bkf_profile_report(BkfProcessor *p);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // BKF_H
@@ -14,6 +14,12 @@
  *  limitations under the License.
  */
 
+// Some of the functions used aren't standard C, but POSIX (or extensions to
+// it that are common enough, like anonymous memory mappings)
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
 #include <stddef.h>
 #include <stdbool.h>
 #include <inttypes.h>
@@ -22,31 +28,126 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <limits.h>
 
 #include <ctype.h>
 #include <assert.h>
 #include <string.h>
+#include <setjmp.h>
 
-#define VERSION "0.1"
+#include "bkf.h"
 
 typedef int32_t i32;
 
+typedef BkfProcessor Processor;
+typedef BkfWord Word;
+typedef BkfValue Value;
+typedef BkfCodeFn CodeWordFn;
+
+// Where the dictionary space is placed, if that address is free. Images of
+// the dictionary hold raw pointers into it, so they can only be loaded back
+// into a space at the same address
+#ifndef BKF_SPACE_BASE
+# if UINTPTR_MAX > 0xFFFFFFFFu
+#  define BKF_SPACE_BASE 0x200000000000u
+# else
+#  define BKF_SPACE_BASE 0x40000000u
+# endif
+#endif // BKF_SPACE_BASE
+
+// Loop stack depth, in nested do loops
+#ifndef BKF_LS_DEPTH
+# define BKF_LS_DEPTH 256
+#endif // BKF_LS_DEPTH
+
+// Most locals a colon word can have
+#ifndef BKF_LOCALS_MAX
+# define BKF_LOCALS_MAX 16
+#endif // BKF_LOCALS_MAX
+
+// Number of entries in the trace buffer, which must be a power of two
+#ifndef BKF_TRACE_SIZE
+# define BKF_TRACE_SIZE 256
+#endif // BKF_TRACE_SIZE
+
+// Capacities of the stacks of a task, small so that there can be many
+#ifndef BKF_TASK_DS_SIZE
+# define BKF_TASK_DS_SIZE 64
+#endif // BKF_TASK_DS_SIZE
+
+#ifndef BKF_TASK_RS_DEPTH
+# define BKF_TASK_RS_DEPTH 64
+#endif // BKF_TASK_RS_DEPTH
+
+#ifndef BKF_TASK_LS_DEPTH
+# define BKF_TASK_LS_DEPTH 8
+#endif // BKF_TASK_LS_DEPTH
+
 #ifdef __GNUC__
 # define UNUSED __attribute__((unused))
 #else
 # define UNUSED
 #endif // __GNUC__
 
+// Unless told otherwise, use direct threading when the compiler supports
+// computed gotos (labels as values), which GCC and clang do
+#ifndef BKF_THREADED
+# ifdef __GNUC__
+#  define BKF_THREADED 1
+# else
+#  define BKF_THREADED 0
+# endif // __GNUC__
+#endif // BKF_THREADED
+
+// With BKF_COMPACT set, colon bodies are made of 16-bit tokens, which index
+// a table of the words, instead of pointers to the words. They take a
+// fraction of the memory, for a lookup in the table on every instruction
+#ifndef BKF_COMPACT
+# define BKF_COMPACT 0
+#endif // BKF_COMPACT
+
+// The JIT, which compiles the colon words called most often to native
+// code, is only available on x86-64 and AArch64 systems with mmap. It
+// translates pointer threaded code only
+#ifndef BKF_JIT
+# if (defined(__x86_64__) || defined(__aarch64__)) && defined(__GNUC__) \
+        && (defined(__unix__) || defined(__APPLE__)) && !BKF_COMPACT
+#  define BKF_JIT 1
+# else
+#  define BKF_JIT 0
+# endif
+#endif // BKF_JIT
+
+#if BKF_JIT && BKF_COMPACT
+# error "the JIT can't translate compact code, build it with BKF_JIT=0"
+#endif
+
+// Workers, processors running words on threads of their own, need POSIX
+// threads
+#ifndef BKF_WORKERS
+# if defined(__unix__) || defined(__APPLE__)
+#  define BKF_WORKERS 1
+# else
+#  define BKF_WORKERS 0
+# endif
+#endif // BKF_WORKERS
+
+// Size of the dictionary space of a worker, in cells, for what it defines
+// on its own
+#ifndef BKF_WORKER_DICT_SIZE
+# define BKF_WORKER_DICT_SIZE (1 << 16)
+#endif // BKF_WORKER_DICT_SIZE
+
+_Noreturn void out_of_memory(void);
+
 void *realloc_mem(void *ptr, size_t size) {
     if(size == 0) {
         free(ptr);
         return NULL;
     }
     void *new_ptr = realloc(ptr, size);
-    if(new_ptr == NULL) {
-        fprintf(stderr, "error: out of memory\n");
-        exit(64);
-    }
+    if(new_ptr == NULL) out_of_memory();
     return new_ptr;
 }
 
@@ -66,17 +167,25 @@ StringView sv_init(char *str) {
     return (StringView){ .text = str, strlen(str) };
 }
 
-StringView sv_copy(StringView src) {
-    StringView dest = { .len = src.len };
-    dest.text = get_mem(src.len + 1);
-    memcpy(dest.text, src.text, src.len);
-    return dest;
-}
-
 void sv_free(StringView sv) {
     free_mem(sv.text);
 }
 
+bool sv_is(StringView sv, const char *text) {
+    return sv.len == (int)strlen(text) && memcmp(sv.text, text, sv.len) == 0;
+}
+
+// Case insensitive FNV-1a hash
+uint32_t sv_hash(StringView sv) {
+    uint32_t h = 2166136261u;
+    for(int i = 0; i < sv.len; ++i) {
+        uint8_t c = sv.text[i];
+        if(c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
 // Case insensitive string comparison is non-portable in C, unless you
 // employ a healthy dose of preprocessor black magic
 #ifdef _MSC_VER
@@ -87,16 +196,6 @@ void sv_free(StringView sv) {
 
 // -----------------------------------------------------------------------------
 
-struct processor;
-typedef void (*CodeWordFn)(struct processor *);
-
-typedef union value {
-    i32 num;
-    char ch;
-    struct word *xt;  // execution token for a word
-    union value *addr; // address of a variable or instruction
-} Value;
-
 Value value_read_num(StringView sv, bool *ok) {
     int i = 0;
     i32 n = 0;
@@ -117,13 +216,21 @@ Value value_read_num(StringView sv, bool *ok) {
 }
 
 Value value_read_ch(StringView sv, bool *ok) {
-    if(sv.len > 3 || sv.text[2] != '\'') {
+    if(sv.len != 3 || sv.text[2] != '\'') {
         *ok = false;
         return (Value){ .ch = 0 };
     }
     return (Value){ .ch = sv.text[1] };
 }
 
+// Whether the text has the shape of a numeric or character literal
+bool value_is_literal(StringView sv) {
+    if(isdigit(sv.text[0])) return true;
+    if(sv.text[0] == '-')
+        return sv.len > 1 && isdigit(sv.text[1]);
+    return sv.len == 3 && sv.text[0] == '\'' && sv.text[2] == '\'';
+}
+
 Value value_read(StringView sv, bool *ok) {
     *ok = true;
     if(sv.text[0] == '-' || isdigit(sv.text[0]))
@@ -136,65 +243,36 @@ Value value_read(StringView sv, bool *ok) {
 
 // -----------------------------------------------------------------------------
 
-typedef struct {
-    Value *contents;
-    int count, capacity;
-} DataStack;
-
-void ds_init(DataStack *ds) {
-    ds->contents = NULL;
-    ds->count = ds->capacity = 0;
-}
-
-void ds_push(DataStack *ds, Value c) {
-    if(ds->count + 1 > ds->capacity) {
-        ds->capacity = (ds->capacity == 0) ?
-            8 : ds->capacity * 2;
-        ds->contents = realloc_mem(ds->contents,
-                ds->capacity * sizeof(*ds->contents));
-    }
-    ds->contents[ds->count++] = c;
-}
-
-void ds_push_num(DataStack *ds, i32 num) {
-    Value v = { .num = num };
-    ds_push(ds, v);
-}
-
-void ds_push_xt(DataStack *ds, struct word *word) {
-    Value v = { .xt = word };
-    ds_push(ds, v);
-}
-
-void ds_push_addr(DataStack *ds, Value *addr) {
-    if(addr == NULL) return;
-    Value v = { .addr = addr };
-    ds_push(ds, v);
-}
-
-int ds_pop(DataStack *ds, Value *out) {
-    if(ds->count == 0) return -1; // underflow
-    *out = ds->contents[--ds->count];
-    return 0;
-}
+// Stacks used by the processor have a fixed capacity, decided when they are
+// created, and a few guard cells below their base. The guard cells let the
+// inner interpreter cache the top of an empty stack without special cases
+#define STACK_GUARD 8
 
-Value *ds_pop_addr(DataStack *ds) {
-    if(ds->count == 0) return NULL;
-    return ds->contents[--ds->count].addr;
+typedef struct {
+    Value *base;  // bottom cell
+    Value *sp;    // top cell, or base - 1 if the stack is empty
+    Value *limit; // last usable cell
+} Stack;
+
+// Sets up a stack in mem, which must hold STACK_GUARD + capacity cells
+void stack_place(Stack *s, Value *mem, int capacity) {
+    memset(mem, 0, STACK_GUARD * sizeof(*mem));
+    s->base = mem + STACK_GUARD;
+    s->sp = s->base - 1;
+    s->limit = s->base + capacity - 1;
 }
 
-Value *ds_top(const DataStack *ds) {
-    if(ds->count == 0) return NULL;
-    return &ds->contents[ds->count - 1];
+void stack_init(Stack *s, int capacity) {
+    stack_place(s, get_mem((STACK_GUARD + capacity) * sizeof(Value)), capacity);
 }
 
-void ds_clear(DataStack *ds) {
-    ds->count = 0;
+int stack_depth(const Stack *s) {
+    return s->sp - s->base + 1;
 }
 
-void ds_free(DataStack *ds) {
-    realloc_mem(ds->contents, 0);
-    ds_init(ds);
+void stack_free(Stack *s) {
+    free_mem(s->base - STACK_GUARD);
+    s->base = s->sp = s->limit = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -204,42 +282,249 @@ typedef enum : uint8_t {
     FLAG_immediate = (1 << 1), // executed on compile time?
     FLAG_hidden    = (1 << 2), // hidden to the user?
     FLAG_comp_only = (1 << 3), // only valid in definitions?
+    FLAG_inline    = (1 << 4), // always inlined, whatever the size?
+    FLAG_noinline  = (1 << 5), // never inlined?
+    FLAG_straight  = (1 << 6), // body can be copied to inline it?
+    FLAG_raw       = (1 << 7), // body has cells compiled by hand?
 } WordFlag;
 
 #define check_flag(flags, f) ((flags) & (f))
 
-typedef struct word {
-    struct word *prev;
-    StringView name;
-    uint8_t flags;
+// Operations known to the inner interpreter. Except for OP_code, OP_colon,
+// OP_safe, OP_constant and OP_marker, each is a primitive that is
+// implemented directly by it
+typedef enum : uint8_t {
+    OP_code,  // call the C function of a code word
+    OP_colon, // enter a colon word
+    OP_safe,  // enter a colon word whose stack effect is known
+    OP_constant, // push the value of a constant
+    OP_marker,   // forget the words from a marker on
+    OP_exit,
+    OP_push,
+    OP_tail, // enter a colon word in place of the current one
+    OP_branch,
+    OP_zero_branch,
+    OP_do,
+    OP_loop,
+    OP_plus_loop,
+    OP_loop_i,
+    OP_loop_j,
+    OP_unloop,
+    OP_execute,
+    OP_pause,
+    OP_stop,
+    OP_activate,
+    OP_frame, // make room for the locals of a colon word
+    OP_local_fetch,
+    OP_local_store,
+    OP_leave, // drop the locals and exit
+#if BKF_JIT
+    OP_jit, // call the native code of a colon word
+#endif // BKF_JIT
+    OP_fetch,
+    OP_store,
+    OP_index,
+    OP_dup,
+    OP_drop,
+    OP_swap,
+    OP_over,
+    OP_rot,
+    OP_add,
+    OP_sub,
+    OP_mul,
+    OP_div,
+    OP_less,
+    OP_less_eq,
+    OP_greater,
+    OP_greater_eq,
+    OP_equals,
+    OP_not_eq,
+    OP_and,
+    OP_or,
+    OP_xor,
+    OP_zero_equals,
+    OP_nip,
+    OP_two_dup,
+    // Superinstructions, made by the compiler by fusing others together
+    OP_lit_add,
+    OP_lit_sub,
+    OP_lit_less,
+    OP_lit_equals,
+    OP_lit_fetch,
+    OP_lit_store,
+    OP_dup_fetch,
+    OP_swap_store,
+    OP_over_add,
+    OP_dup_fetch_lit_add,
+    OP_lit_add_store,
+    OP_count
+} Opcode;
+
+// Number of cells following each operation in threaded code, as operands
+static const uint8_t op_operands[OP_count] = {
+    [OP_push]             = 1,
+    [OP_tail]             = 1,
+    [OP_branch]           = 1,
+    [OP_zero_branch]      = 1,
+    [OP_loop]             = 1,
+    [OP_plus_loop]        = 1,
+    [OP_frame]            = 1,
+    [OP_local_fetch]      = 1,
+    [OP_local_store]      = 1,
+    [OP_leave]            = 1,
+    [OP_lit_add]          = 1,
+    [OP_lit_sub]          = 1,
+    [OP_lit_less]         = 1,
+    [OP_lit_equals]       = 1,
+    [OP_lit_fetch]        = 1,
+    [OP_lit_store]        = 1,
+    [OP_dup_fetch_lit_add] = 1,
+    [OP_lit_add_store]    = 1,
+};
+
+// Whether the operand of the operation is a branch offset, in cells from
+// the operand itself
+static inline bool op_branches(Opcode op) {
+    return op == OP_branch || op == OP_zero_branch
+        || op == OP_loop || op == OP_plus_loop;
+}
+
+// Whether the operation leaves the word, so that a body can end with it
+static inline bool op_ends(Opcode op) {
+    return op == OP_exit || op == OP_tail || op == OP_leave;
+}
+
+// Locals live in a frame on the R stack, right above the return address of
+// their word, with the first one the deepest. The operand of a frame packs
+// the cells in it with how many of them are taken from the data stack, and
+// those of the other operations are the distance of a local from the top
+static inline Value frame_operand(int cells, int init) {
+    return (Value){ .num = cells << 8 | init };
+}
 
+// Effect of a word on the data stack: the cells it takes and the ones it
+// leaves, and the most the stack grows by over its depth on entry while the
+// word runs. A negative in means that the effect isn't known
+typedef struct {
+    int16_t in, out, grow;
+} Effect;
+
+#define EFFECT_UNKNOWN ((Effect){ .in = -1, .out = 0, .grow = 0 })
+
+// Effects of the primitives, without the cells taken by branches and loops
+// from the stack in their operands. Calls don't have one of their own
+static const Effect op_effects[OP_count] = {
+    [OP_code]             = { -1, 0, 0 },
+    [OP_colon]            = { -1, 0, 0 },
+    [OP_safe]             = { -1, 0, 0 },
+    [OP_tail]             = { -1, 0, 0 },
+    [OP_execute]          = { -1, 0, 0 },
+    [OP_activate]         = { -1, 0, 0 }, // the rest runs on other stacks
+    [OP_frame]            = { -1, 0, 0 }, // depends on the operand
+#if BKF_JIT
+    [OP_jit]              = { -1, 0, 0 },
+#endif // BKF_JIT
+    [OP_constant]         = { 0, 1, 1 },
+    [OP_marker]           = { 0, 0, 0 },
+    [OP_push]             = { 0, 1, 1 },
+    [OP_zero_branch]      = { 1, 0, 0 },
+    [OP_do]               = { 2, 0, 0 },
+    [OP_plus_loop]        = { 1, 0, 0 },
+    [OP_loop_i]           = { 0, 1, 1 },
+    [OP_loop_j]           = { 0, 1, 1 },
+    [OP_local_fetch]      = { 0, 1, 1 },
+    [OP_local_store]      = { 1, 0, 0 },
+    [OP_leave]            = { 0, 0, 0 },
+    [OP_fetch]            = { 1, 1, 0 },
+    [OP_store]            = { 2, 0, 0 },
+    [OP_index]            = { 2, 1, 0 },
+    [OP_dup]              = { 1, 2, 1 },
+    [OP_drop]             = { 1, 0, 0 },
+    [OP_swap]             = { 2, 2, 0 },
+    [OP_over]             = { 2, 3, 1 },
+    [OP_rot]              = { 3, 3, 0 },
+    [OP_add]              = { 2, 1, 0 },
+    [OP_sub]              = { 2, 1, 0 },
+    [OP_mul]              = { 2, 1, 0 },
+    [OP_div]              = { 2, 1, 0 },
+    [OP_less]             = { 2, 1, 0 },
+    [OP_less_eq]          = { 2, 1, 0 },
+    [OP_greater]          = { 2, 1, 0 },
+    [OP_greater_eq]       = { 2, 1, 0 },
+    [OP_equals]           = { 2, 1, 0 },
+    [OP_not_eq]           = { 2, 1, 0 },
+    [OP_and]              = { 2, 1, 0 },
+    [OP_or]               = { 2, 1, 0 },
+    [OP_xor]              = { 2, 1, 0 },
+    [OP_zero_equals]      = { 1, 1, 0 },
+    [OP_nip]              = { 2, 1, 0 },
+    [OP_two_dup]          = { 2, 4, 2 },
+    [OP_lit_add]          = { 1, 1, 0 },
+    [OP_lit_sub]          = { 1, 1, 0 },
+    [OP_lit_less]         = { 1, 1, 0 },
+    [OP_lit_equals]       = { 1, 1, 0 },
+    [OP_lit_fetch]        = { 0, 1, 1 },
+    [OP_lit_store]        = { 1, 0, 0 },
+    [OP_dup_fetch]        = { 1, 2, 1 },
+    [OP_swap_store]       = { 2, 0, 0 },
+    [OP_over_add]         = { 2, 2, 0 },
+    [OP_dup_fetch_lit_add] = { 1, 2, 1 },
+    [OP_lit_add_store]    = { 1, 0, 0 },
+};
+
+// A cell of threaded code. Compact code has the token of a word where
+// pointer threaded code has its address, and packs each operand in as few
+// cells as it fits in
+#if BKF_COMPACT
+typedef uint16_t Code;
+# define CODE_TOKENS (1 << 16)
+#else
+typedef Value Code;
+#endif // BKF_COMPACT
+
+// Words live in the dictionary space, each header followed by its name
+// and, for colon words, by its threaded code. The header is packed, with
+// the pointers first and the small fields after them, and the name is
+// found from its length alone, so that walking and searching the words
+// touches as few cache lines as it can
+typedef struct bkf_word {
+    struct bkf_word *prev;
+    struct bkf_word *next_hash; // next word in the same index bucket
     union {
-        CodeWordFn code; // valid if flags & FLAG_code
-        DataStack colon; // valid otherwise
+        CodeWordFn code;      // valid if flags & FLAG_code
+        Code *body;           // valid otherwise
+        Value value;          // valid if op is OP_constant
+        uintptr_t code_index; // replaces code in images
     } as;
+#if BKF_JIT
+    // Native code of a colon word, valid if op is OP_jit. It returns the
+    // word of a tail call left for its caller to make, if any
+    struct bkf_word *(*native)(struct bkf_processor *);
+    uint32_t calls; // counted until the JIT threshold is reached
+#endif // BKF_JIT
+    uint32_t hash; // case insensitive hash of the name
+    Effect effect;
+    uint8_t flags;
+    uint8_t op; // how the inner interpreter executes the word
+    uint8_t name_len;
+#if BKF_COMPACT
+    uint16_t token; // index of the word in the table of the processor
+#endif // BKF_COMPACT
 } Word;
 
-Word *word_new(StringView name, uint8_t flags) {
-    Word *w = get_mem(sizeof(*w));
-    w->prev = NULL;
-    w->flags = flags;
-    w->name = sv_copy(name);
-    if(!check_flag(flags, FLAG_code))
-        ds_init(&w->as.colon);
-    return w;
-}
+#define WORD_NAME_MAX UINT8_MAX
 
-Word *word_code_new(StringView name, CodeWordFn body) {
-    Word *w = word_new(name, FLAG_code);
-    w->as.code = body;
-    return w;
+// The name follows the header, and ends with a null character
+static inline StringView word_name(const Word *w) {
+    return (StringView){ .text = (char*)(w + 1), .len = w->name_len };
 }
 
-void word_free(Word *w) {
-    sv_free(w->name);
-    if(!check_flag(w->flags, FLAG_code))
-        ds_free(&w->as.colon);
-    free_mem(w);
+// Whether the word is a colon word, which might have been compiled
+bool word_is_colon(const Word *w) {
+#if BKF_JIT
+    if(w->op == OP_jit) return true;
+#endif // BKF_JIT
+    return w->op == OP_colon || w->op == OP_safe;
 }
 
 void word_list_add(Word **last, Word *w) {
@@ -247,456 +532,1417 @@ void word_list_add(Word **last, Word *w) {
     *last = w;
 }
 
-Word *word_list_find(Word *last, StringView name) {
-    Word *w = last;
+// Hash table indexing the word list by name. Each bucket chains its words
+// from the newest to the oldest, so that the newest definition wins
+typedef struct {
+    Word **buckets;
+    int size, count; // size is always a power of two
+} WordIndex;
+
+void index_init(WordIndex *idx) {
+    idx->size = 256;
+    idx->count = 0;
+    idx->buckets = get_mem(idx->size * sizeof(*idx->buckets));
+    memset(idx->buckets, 0, idx->size * sizeof(*idx->buckets));
+}
+
+void index_grow(WordIndex *idx) {
+    int size = idx->size * 2;
+    Word **buckets = get_mem(size * sizeof(*buckets));
+    Word **tails = get_mem(size * sizeof(*tails));
+    memset(buckets, 0, size * sizeof(*buckets));
+    // Appending to the tail of the new chains keeps words with the same
+    // name in the same relative order
+    for(int i = 0; i < idx->size; ++i) {
+        Word *w = idx->buckets[i], *aux;
+        while(w != NULL) {
+            aux = w->next_hash;
+            int b = w->hash & (size - 1);
+            w->next_hash = NULL;
+            if(buckets[b] == NULL) buckets[b] = w;
+            else tails[b]->next_hash = w;
+            tails[b] = w;
+            w = aux;
+        }
+    }
+    free_mem(tails);
+    free_mem(idx->buckets);
+    idx->buckets = buckets;
+    idx->size = size;
+}
+
+void index_add(WordIndex *idx, Word *w) {
+    if(idx->count + 1 > idx->size) index_grow(idx);
+    int b = w->hash & (idx->size - 1);
+    w->next_hash = idx->buckets[b];
+    idx->buckets[b] = w;
+    idx->count += 1;
+}
+
+// Takes out a word, which must be the newest in its bucket
+void index_remove(WordIndex *idx, Word *w) {
+    int b = w->hash & (idx->size - 1);
+    assert(idx->buckets[b] == w);
+    idx->buckets[b] = w->next_hash;
+    idx->count -= 1;
+}
+
+Word *index_find(const WordIndex *idx, StringView name) {
+    uint32_t h = sv_hash(name);
+    Word *w = idx->buckets[h & (idx->size - 1)];
     while(w != NULL) {
-        if(!check_flag(w->flags, FLAG_hidden)
-                && w->name.len == name.len
-                && strncasecmp(name.text, w->name.text, name.len) == 0)
+        if(w->hash == h
+                && !check_flag(w->flags, FLAG_hidden)
+                && w->name_len == name.len
+                && strncasecmp(name.text, word_name(w).text, name.len) == 0)
             return w;
-        w = w->prev;
+        w = w->next_hash;
     }
     return NULL;
 }
 
-void word_list_free(Word *last) {
-    Word *w = last, *aux;
-    while(w != NULL) {
-        aux = w->prev;
-        word_free(w);
-        w = aux;
-    }
+void index_free(WordIndex *idx) {
+    free_mem(idx->buckets);
+    idx->buckets = NULL;
+    idx->size = idx->count = 0;
 }
 
 // -----------------------------------------------------------------------------
 
+#define SCAN_SIZE 4096
+
+// The source is either a string known in full, or a stream read in chunks
+// into a buffer owned by the scanner. When the buffer runs out, what is left
+// of the word being scanned is moved to its start and the rest refilled, so
+// words are never split, but the text of a word is only valid until the next
+// one is scanned
+//
+// Positions are only needed to report errors, so the line and column of the
+// current word aren't tracked as it goes, but worked out by scan_locate from
+// the last place they're known at
 typedef struct {
     StringView source;
     int offset;
     int line;
-    int start_col, col;
+    int start_col;
+    char *located; // where line and start_col are at
+    FILE *stream;
+    char *buf;
+    int cap;
 } Scanner;
 
+// Classes of the characters, by which the scanner splits the source. Words
+// are made of anything that isn't white space
+enum { CLASS_space = 1 << 0 };
+
+static const uint8_t scan_class[256] = {
+    [' '] = CLASS_space, ['\t'] = CLASS_space, ['\n'] = CLASS_space,
+    ['\v'] = CLASS_space, ['\f'] = CLASS_space, ['\r'] = CLASS_space,
+};
+
+static inline bool scan_is_space(char c) {
+    return scan_class[(uint8_t)c] & CLASS_space;
+}
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define SCAN_VECTOR 16
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+# define SCAN_VECTOR 16
+#endif // __SSE2__
+
+// Counts the characters at the start of text that are white space or, if
+// space is false, that aren't. Whole vectors of them are checked at once
+// where possible
+int scan_span(const char *text, int len, bool space) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    for(; i + SCAN_VECTOR <= len; i += SCAN_VECTOR) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&text[i]);
+        // \t to \r are the 5 characters from 9 on
+        __m128i ctrl = _mm_sub_epi8(v, tab);
+        __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(v, blank),
+                _mm_cmpeq_epi8(_mm_min_epu8(ctrl, four), ctrl));
+        unsigned mask = _mm_movemask_epi8(is_space);
+        if(space) mask = ~mask & 0xFFFF;
+        if(mask != 0) return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t blank = vdupq_n_u8(' '), tab = vdupq_n_u8('\t');
+    const uint8x16_t four = vdupq_n_u8(4);
+    for(; i + SCAN_VECTOR <= len; i += SCAN_VECTOR) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)&text[i]);
+        uint8x16_t is_space = vorrq_u8(vceqq_u8(v, blank),
+                vcleq_u8(vsubq_u8(v, tab), four));
+        if(space) is_space = vmvnq_u8(is_space);
+        // Narrowing leaves 4 bits for each character, set if it ends the span
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                    vshrn_n_u16(vreinterpretq_u16_u8(is_space), 4)), 0);
+        if(mask != 0) return i + __builtin_ctzll(mask) / 4;
+    }
+#endif // __SSE2__
+    while(i < len && scan_is_space(text[i]) == space) i += 1;
+    return i;
+}
+
 void scan_init(Scanner *s, StringView source) {
     s->source = source;
     s->offset = 0;
     s->line = 1;
-    s->start_col = s->col = 1;
+    s->start_col = 1;
+    s->located = source.text;
+    s->stream = NULL;
+    s->buf = NULL;
+    s->cap = 0;
+}
+
+void scan_init_stream(Scanner *s, FILE *stream) {
+    scan_init(s, (StringView){ .text = NULL, .len = 0 });
+    s->stream = stream;
+    s->cap = SCAN_SIZE;
+    s->buf = realloc_mem(NULL, s->cap + 1);
+    s->buf[0] = '\0';
+    s->source.text = s->located = s->buf;
+}
+
+void scan_free(Scanner *s) {
+    free_mem(s->buf);
+    s->buf = NULL;
+    s->stream = NULL;
+}
+
+// Works out the line and column of the current word, from those of the
+// place where they were last worked out
+void scan_locate(Scanner *s) {
+    char *text = s->located, *end = s->source.text, *nl;
+    while(text < end && (nl = memchr(text, '\n', end - text)) != NULL) {
+        s->line += 1;
+        s->start_col = 1;
+        text = nl + 1;
+    }
+    s->start_col += end - text;
+    s->located = end;
+}
+
+// Reads more of the stream, keeping the text from the start of the current
+// word on. Returns whether anything was read
+bool scan_refill(Scanner *s) {
+    if(s->stream == NULL) return false;
+    scan_locate(s);
+    int keep = s->source.len;
+    if(keep == s->cap) {
+        int start = s->source.text - s->buf;
+        s->cap *= 2;
+        s->buf = realloc_mem(s->buf, s->cap + 1);
+        s->source.text = &s->buf[start];
+    }
+    memmove(s->buf, s->source.text, keep);
+    int n = fread(&s->buf[keep], sizeof(char), s->cap - keep, s->stream);
+    s->source.text = s->located = s->buf;
+    s->source.len = keep + n;
+    s->buf[s->source.len] = '\0';
+    return n > 0;
+}
+
+// Forgets the text before the current position, so it isn't kept on refills
+void scan_drop(Scanner *s) {
+    s->source.text = &s->source.text[s->offset];
+    s->source.len -= s->offset;
+    s->offset = 0;
 }
 
+// The source may be a mapped file, which has no terminator to read at the end
 char scan_peek(const Scanner *s) {
-    return s->source.text[s->offset];
+    return s->offset < s->source.len ? s->source.text[s->offset] : '\0';
 }
 
 StringView scan_peek_text(const Scanner *s) {
     return (StringView){ .text = s->source.text, .len = s->offset };
 }
 
-bool scan_end(const Scanner *s) {
-    return s->offset >= s->source.len;
+bool scan_end(Scanner *s) {
+    return s->offset >= s->source.len && !scan_refill(s);
 }
 
 void scan_advance(Scanner *s) {
     if(scan_end(s)) return;
     s->offset += 1;
-    s->col += 1;
 }
 
 void scan_sync(Scanner *s) {
-    while(isspace(scan_peek(s)) && !scan_end(s)) {
-        if(scan_peek(s) == '\n') {
-            s->line += 1;
-            s->col = 0;
+    do {
+        s->offset += scan_span(&s->source.text[s->offset],
+                s->source.len - s->offset, true);
+        scan_drop(s);
+    } while(s->source.len == 0 && scan_refill(s));
+}
+
+// Skips the source up to and including the next occurrence of c
+void scan_skip_past(Scanner *s, char c) {
+    do {
+        char *text = &s->source.text[s->offset];
+        char *found = memchr(text, c, s->source.len - s->offset);
+        if(found != NULL) {
+            s->offset += found - text + 1;
+            return;
         }
-        scan_advance(s);
-    }
-    s->source.text = &s->source.text[s->offset];
-    s->source.len -= s->offset;
-    s->offset = 0;
-    s->start_col = s->col;
+        s->offset = s->source.len;
+        scan_drop(s);
+    } while(scan_refill(s));
 }
 
 StringView scan_word(Scanner *s) {
     scan_sync(s);
-    while(!isspace(scan_peek(s)) && !scan_end(s))
-        scan_advance(s);
+    do {
+        s->offset += scan_span(&s->source.text[s->offset],
+                s->source.len - s->offset, false);
+    } while(s->offset == s->source.len && scan_refill(s));
     return scan_peek_text(s);
 }
 
 // -----------------------------------------------------------------------------
 
-typedef struct processor {
-    Scanner scan;
-    Value *ip;    // instruction pointer
-    DataStack ds; // parameter stack, for general use data
-    DataStack rs; // R stack, for auxiliary data
-    bool panic;   // critical error?
-    bool verbose; // verbose error messages?
-
-    Word *dict;      // word list
-    Word *comp_word; // word currently being compiled
-
-    // Address of a couple significant words
-    Word *w_exit;
-    Word *w_push;
-} Processor;
-
-void load_builtin(Processor *p);
+// Checking whether a file is a terminal is not part of standard C either
+#ifdef _MSC_VER
+# include <io.h>
+# define isatty _isatty
+# define fileno _fileno
+#else
+# include <unistd.h>
+#endif // _MSC_VER
 
-void proc_init(Processor *p) {
-    p->ip = NULL;
-    ds_init(&p->ds);
-    ds_init(&p->rs);
-    p->panic = false;
-    p->verbose = false;
+#define OUT_SIZE 4096
 
-    p->dict = NULL;
-    p->comp_word = NULL;
-    load_builtin(p);
+// Output of the processor. It is kept in a buffer, and numbers are formatted
+// by hand, instead of going through stdio for every value printed
+typedef struct {
+    FILE *fp;
+    bool tty;        // is the output a terminal?
+    bool unbuffered; // write everything out right away?
+    int len;
+    char buf[OUT_SIZE];
+} Output;
+
+void out_init(Output *out, FILE *fp) {
+    out->fp = fp;
+    out->tty = isatty(fileno(fp));
+    out->unbuffered = false;
+    out->len = 0;
 }
 
-bool proc_compile_mode(const Processor *p) {
-    return p->comp_word != NULL;
+void out_flush(Output *out) {
+    if(out->len > 0) fwrite(out->buf, 1, out->len, out->fp);
+    out->len = 0;
+    fflush(out->fp);
 }
 
-void proc_free(Processor *p) {
-    ds_free(&p->ds);
-    ds_free(&p->rs);
-    word_list_free(p->dict);
-    proc_init(p);
+void out_write(Output *out, const char *text, int len) {
+    if(out->len + len > OUT_SIZE) {
+        out_flush(out);
+        if(len > OUT_SIZE) {
+            fwrite(text, 1, len, out->fp);
+            return;
+        }
+    }
+    memcpy(&out->buf[out->len], text, len);
+    out->len += len;
+    if(out->unbuffered) out_flush(out);
 }
 
-void load_source(Processor *p, StringView source) {
-    scan_init(&p->scan, source);
+void out_str(Output *out, const char *str) {
+    out_write(out, str, strlen(str));
 }
 
-void error(Processor *p, const char *err_msg) {
-    if(p->verbose)
-        fprintf(stderr, "(%d:%d) error: %s\n",
-                p->scan.line, p->scan.start_col, err_msg);
-    else fprintf(stderr, "%s\n", err_msg);
-    p->panic = true;
+void out_char(Output *out, char c) {
+    out_write(out, &c, 1);
 }
 
-void error_undef(Processor *p, StringView word) {
-    if(p->verbose)
-        fprintf(stderr, "(%d:%d) error: undefined word '%.*s'\n",
-                p->scan.line, p->scan.start_col, SV_fmt(word));
-    else fprintf(stderr, "%.*s?\n", SV_fmt(word));
-    p->panic = true;
+void out_num(Output *out, i32 n) {
+    char digits[12];
+    int i = sizeof(digits);
+    uint32_t u = n < 0 ? -(uint32_t)n : (uint32_t)n;
+    do {
+        digits[--i] = '0' + u % 10;
+        u /= 10;
+    } while(u != 0);
+    if(n < 0) digits[--i] = '-';
+    out_write(out, &digits[i], sizeof(digits) - i);
 }
 
-void error_comp_only(Processor *p, StringView word) {
-    if(p->verbose)
-        fprintf(stderr, "(%d:%d) error: word '%.*s' is only valid in definitions\n",
-                p->scan.line, p->scan.start_col, SV_fmt(word));
-    else fprintf(stderr, "%.*s?\n", SV_fmt(word));
-    p->panic = true;
+void out_hex(Output *out, uint32_t u) {
+    char digits[8];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = "0123456789ABCDEF"[u & 0xF];
+        u >>= 4;
+    } while(u != 0);
+    out_write(out, &digits[i], sizeof(digits) - i);
 }
 
-Value proc_pop(Processor *p) {
-    Value c = { .num = 0 };
-    int err = ds_pop(&p->ds, &c);
-    if(!p->panic && err) error(p, "stack underflow");
-    return c;
+// -----------------------------------------------------------------------------
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# define HAVE_MMAP 1
+# ifndef MAP_NORESERVE
+#  define MAP_NORESERVE 0
+# endif // MAP_NORESERVE
+#else
+# define HAVE_MMAP 0
+#endif // __unix__ || __APPLE__
+
+// Reserves the memory of a dictionary space, preferably at BKF_SPACE_BASE
+uint8_t *space_reserve(size_t size) {
+#if HAVE_MMAP
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+# ifdef MAP_FIXED_NOREPLACE
+    void *mem = mmap((void*)BKF_SPACE_BASE, size, prot,
+            flags | MAP_FIXED_NOREPLACE, -1, 0);
+# else
+    void *mem = mmap((void*)BKF_SPACE_BASE, size, prot, flags, -1, 0);
+# endif // MAP_FIXED_NOREPLACE
+    if(mem == MAP_FAILED) mem = mmap(NULL, size, prot, flags, -1, 0);
+    if(mem == MAP_FAILED) out_of_memory();
+    return mem;
+#else
+    return get_mem(size);
+#endif // HAVE_MMAP
 }
 
-// -----------------------------------------------------------------------------
+void space_release(uint8_t *space, size_t size) {
+#if HAVE_MMAP
+    munmap(space, size);
+#else
+    (void) size;
+    free_mem(space);
+#endif // HAVE_MMAP
+}
 
-void execute_word(Processor *p, Word *w) {
-    if(check_flag(w->flags, FLAG_code)) {
-        w->as.code(p);
-        return;
-    }
-    DataStack *word_body = &w->as.colon;
-    if(word_body->count == 0) return; // empty word
+size_t page_size(void) {
+#if HAVE_MMAP
+    return sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif // HAVE_MMAP
+}
 
-    Value *old_ip = p->ip;
-    p->ip = word_body->contents;
-    while(p->ip >= word_body->contents
-            && p->ip < word_body->contents + word_body->count) {
-        Word *operation = p->ip->xt;
-        execute_word(p, operation);
-        if(p->ip == NULL) break;
-        p->ip += 1;
-    }
-    p->ip = old_ip;
-    ds_clear(&p->rs);
+// Maps a file to memory, read only, so it can be scanned in place. Only
+// regular files can be, the text of the view is NULL for anything else
+StringView file_map(FILE *fp) {
+    StringView source = { .text = NULL, .len = 0 };
+#if HAVE_MMAP
+    struct stat st;
+    int fd = fileno(fp);
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return source;
+    if(st.st_size == 0 || st.st_size > INT32_MAX) return source;
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mem == MAP_FAILED) return source;
+    posix_madvise(mem, st.st_size, POSIX_MADV_SEQUENTIAL);
+    source = (StringView){ .text = mem, .len = st.st_size };
+#else
+    (void) fp;
+#endif // HAVE_MMAP
+    return source;
 }
 
-void proc_comp_push(Processor *p, Word *w, Value val) {
-    ds_push_xt(&w->as.colon, p->w_push);
-    ds_push(&w->as.colon, val);
+void file_unmap(StringView source) {
+#if HAVE_MMAP
+    munmap(source.text, source.len);
+#else
+    (void) source;
+#endif // HAVE_MMAP
 }
 
-void proc_next(Processor *p) {
-    bool is_val = false;
-    StringView name = scan_word(&p->scan);
-    if(name.len == 0) return;
-    Word *w = word_list_find(p->dict, name);
-    if(w == NULL) {
-        Value operand = value_read(name, &is_val);
-        if(!is_val) {
-            error_undef(p, name);
+// Peephole rules for the compiler: an instruction with the operation first
+// followed by one with second is replaced by a single fused instruction,
+// which takes the operands of both. Fused instructions can be fused again,
+// so some rules actually cover sequences of three. With zero set, the rule
+// only applies if the operand of first is 0, and that operand is dropped
+typedef struct {
+    Opcode first, second, fused;
+    bool zero;
+} Fusion;
+
+static const Fusion fusions[] = {
+    { OP_push,              OP_equals,     OP_zero_equals, true },
+    { OP_push,              OP_add,        OP_lit_add, false },
+    { OP_push,              OP_sub,        OP_lit_sub, false },
+    { OP_push,              OP_less,       OP_lit_less, false },
+    { OP_push,              OP_equals,     OP_lit_equals, false },
+    { OP_push,              OP_fetch,      OP_lit_fetch, false },
+    { OP_push,              OP_store,      OP_lit_store, false },
+    { OP_dup,               OP_fetch,      OP_dup_fetch, false },
+    { OP_swap,              OP_store,      OP_swap_store, false },
+    { OP_swap,              OP_drop,       OP_nip, false },
+    { OP_over,              OP_over,       OP_two_dup, false },
+    { OP_over,              OP_add,        OP_over_add, false },
+    { OP_dup_fetch,         OP_lit_add,    OP_dup_fetch_lit_add, false },
+    { OP_dup_fetch_lit_add, OP_swap_store, OP_lit_add_store, false },
+};
+
+#define FUSION_COUNT ((int)(sizeof(fusions) / sizeof(*fusions)))
+
+#ifdef BKF_PAIR_STATS
+// When built with BKF_PAIR_STATS, the inner interpreter counts how often
+// each pair of instructions runs one after the other within a body, to
+// find out which fusions would pay off
+#define PAIRS_SIZE 4096
+
+typedef struct {
+    struct bkf_word *first, *second;
+    uint64_t count;
+} PairCount;
+
+void pairs_count(PairCount *pairs, struct bkf_word *first, struct bkf_word *second) {
+    uintptr_t h = ((uintptr_t)first * 31 + (uintptr_t)second) >> 3;
+    for(int i = 0; i < PAIRS_SIZE; ++i) {
+        PairCount *pc = &pairs[(h + i) & (PAIRS_SIZE - 1)];
+        if(pc->first == first && pc->second == second) {
+            pc->count += 1;
+            return;
+        }
+        if(pc->first == NULL) {
+            *pc = (PairCount){ .first = first, .second = second, .count = 1 };
             return;
         }
-        if(proc_compile_mode(p))
-            proc_comp_push(p, p->comp_word, operand);
-        else ds_push(&p->ds, operand);
-        return;
-    }
-    if(proc_compile_mode(p)) {
-        if(check_flag(w->flags, FLAG_immediate))
-            execute_word(p, w);
-        else ds_push_xt(&p->comp_word->as.colon, w);
-        return;
     }
-    if(check_flag(w->flags, FLAG_comp_only))
-        error_comp_only(p, name);
-    else execute_word(p, w);
+    // The table is full, so the pair is not counted
 }
+#endif // BKF_PAIR_STATS
 
 // -----------------------------------------------------------------------------
 
-void run_source(Processor *p, StringView source) {
-    p->panic = false;
-    load_source(p, source);
-    while(!scan_end(&p->scan)) {
-        if(p->panic) break; // critical error
-        proc_next(p);
-    }
-}
-
-void repl(Processor *p) {
-    printf("blackknifeforth " VERSION
-            "  Copyright (C) 2025 Eduardo Antunes\n");
-    char buf[2048];
-    while(true) {
-        printf("> ");
-        if(fgets(buf, 2048, stdin) == NULL) break;
-        StringView source = sv_init(buf);
-        run_source(p, source);
-        if(!p->panic) printf(" ok\n");
-    }
-    printf("\n");
-}
-
-StringView read_file(const char *filename) {
-    StringView source = { .text = NULL, .len = 0 }, err = source;
-    FILE *fp = fopen(filename, "rb");
-    if(fp == NULL) return err;
-    fseek(fp, 0, SEEK_END);
-    source.len = ftell(fp);
-    rewind(fp);
-
-    source.text = realloc_mem(NULL, source.len + 1);
-    int n = fread((char*)source.text, sizeof(char),
-            source.len, fp);
-    if(n < source.len) return err;
-    source.text[n] = '\0'; // terminando com 0 manualmente
-    fclose(fp);
-    return source;
+// The profiler counts the calls to each word and the time spent in it, as
+// measured by the fastest clock available, both including (total) and not
+// including (self) the words it calls
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define PROFILE_UNIT "cycles"
+uint64_t profile_clock(void) {
+    return __builtin_ia32_rdtsc();
 }
-
-void run_file(Processor *p, const char *filename) {
-    bool v = p->verbose;
-    p->verbose = true;
-    StringView source = read_file(filename);
-    run_source(p, source);
-    sv_free(source);
-    p->verbose = v;
+#else
+# include <time.h>
+# define PROFILE_UNIT "ns"
+uint64_t profile_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
 }
+#endif
 
-int main() {
-    Processor bkf;
-    proc_init(&bkf);
+typedef struct {
+    struct bkf_word *word;
+    uint64_t calls, total, self;
+    int active; // frames of the word open, so recursion is timed once
+} ProfileEntry;
 
-    run_file(&bkf, "prelude.f");
-    repl(&bkf);
+typedef struct {
+    int entry; // index of the entry of the word
+    uint64_t start, children;
+} ProfileFrame;
 
-    proc_free(&bkf);
-    return 0;
+typedef struct {
+    ProfileEntry *entries; // open addressing, by address of the word
+    int size, count;       // size is always a power of two
+    ProfileFrame *frames;  // words being timed, innermost last
+    int depth, cap;
+} Profile;
+
+void profile_init(Profile *prof) {
+    prof->size = 256;
+    prof->count = 0;
+    prof->entries = get_mem(prof->size * sizeof(*prof->entries));
+    memset(prof->entries, 0, prof->size * sizeof(*prof->entries));
+    prof->frames = NULL;
+    prof->depth = prof->cap = 0;
 }
 
-// -----------------------------------------------------------------------------
-
-Word *code_word(Processor *p, char *name, CodeWordFn body, uint8_t flags) {
-    StringView sv = { .text = name, .len = strlen(name) };
-    Word *w = word_code_new(sv, body);
-    w->flags |= flags;
-    word_list_add(&p->dict, w);
-    return w;
+void profile_free(Profile *prof) {
+    free_mem(prof->entries);
+    free_mem(prof->frames);
 }
 
-void w_define(Processor *p) {
-    StringView name = scan_word(&p->scan);
-    Word *w = word_new(name, FLAG_hidden);
-    p->comp_word = w;
-    word_list_add(&p->dict, w);
+int profile_slot(const Profile *prof, const struct bkf_word *w) {
+    int i = ((uintptr_t)w >> 3) & (prof->size - 1);
+    while(prof->entries[i].word != NULL && prof->entries[i].word != w)
+        i = (i + 1) & (prof->size - 1);
+    return i;
 }
 
-void w_end(Processor *p) {
-    p->comp_word->flags &= ~FLAG_hidden;
-    p->comp_word = NULL;
+// Moves the entries to a table of the given size, leaving out those of the
+// words from start to end, which are forgotten
+void profile_rehash(Profile *prof, int size, uintptr_t start,
+        uintptr_t end) {
+    ProfileEntry *old = prof->entries;
+    int old_size = prof->size;
+    prof->size = size;
+    prof->count = 0;
+    prof->entries = get_mem(prof->size * sizeof(*prof->entries));
+    memset(prof->entries, 0, prof->size * sizeof(*prof->entries));
+    for(int i = 0; i < old_size; ++i) {
+        uintptr_t w = (uintptr_t)old[i].word;
+        if(w == 0 || (w >= start && w < end)) continue;
+        prof->entries[profile_slot(prof, old[i].word)] = old[i];
+        prof->count += 1;
+    }
+    // The frames refer to entries by index, which has just changed
+    for(int i = 0; i < prof->depth; ++i) {
+        ProfileFrame *f = &prof->frames[i];
+        f->entry = profile_slot(prof, old[f->entry].word);
+    }
+    free_mem(old);
 }
 
-void w_immediate(Processor *p) {
-    p->comp_word->flags |= FLAG_immediate;
+void profile_grow(Profile *prof) {
+    profile_rehash(prof, 2 * prof->size, 0, 0);
 }
 
-void w_quote(Processor *p) {
-    StringView name = scan_word(&p->scan);
-    Word *w = word_list_find(p->dict, name);
-    ds_push_xt(&p->ds, w);
+void profile_enter(Profile *prof, struct bkf_word *w) {
+    int i = profile_slot(prof, w);
+    if(prof->entries[i].word == NULL) {
+        if(2 * (prof->count + 1) > prof->size) {
+            profile_grow(prof);
+            i = profile_slot(prof, w);
+        }
+        prof->entries[i].word = w;
+        prof->count += 1;
+    }
+    prof->entries[i].calls += 1;
+    prof->entries[i].active += 1;
+    if(prof->depth == prof->cap) {
+        prof->cap = prof->cap == 0 ? 64 : 2 * prof->cap;
+        prof->frames = realloc_mem(prof->frames,
+                prof->cap * sizeof(*prof->frames));
+    }
+    prof->frames[prof->depth++] = (ProfileFrame){
+        .entry = i, .start = profile_clock(), .children = 0
+    };
 }
 
-void w_compile(Processor *p) {
-    Value value = proc_pop(p);
-    ds_push(&p->comp_word->as.colon, value);
+void profile_leave(Profile *prof) {
+    ProfileFrame *f = &prof->frames[--prof->depth];
+    ProfileEntry *e = &prof->entries[f->entry];
+    uint64_t elapsed = profile_clock() - f->start;
+    e->self += elapsed - f->children;
+    if(--e->active == 0) e->total += elapsed;
+    if(prof->depth > 0) prof->frames[prof->depth - 1].children += elapsed;
 }
 
-void w_exit(Processor *p) {
-    p->ip = NULL;
+// Closes the frames left open by words that failed
+void profile_unwind(Profile *prof, int depth) {
+    while(prof->depth > depth) profile_leave(prof);
 }
 
 // -----------------------------------------------------------------------------
 
-void w_constant(Processor *p) {
-    Value val = proc_pop(p);
-    StringView name = scan_word(&p->scan);
-    Word *w = word_new(name, 0);
-    proc_comp_push(p, w, val);
-    word_list_add(&p->dict, w);
+// When tracing, the inner interpreter records every instruction it runs in
+// a ring buffer, which is dumped when an error happens, when asked to with
+// trace-dump or on a signal. The interpreter is the only writer, and it
+// publishes each entry by advancing the count, so a signal handler can read
+// the buffer without locks
+typedef struct {
+    struct bkf_word *xt;
+    Code *ip; // address of the instruction
+    i32 depth; // of the data stack, before the instruction
+    Value tos;
+} TraceEntry;
+
+typedef struct {
+    TraceEntry entries[BKF_TRACE_SIZE];
+    atomic_uint count; // entries ever recorded
+} Trace;
+
+static inline void trace_record(Trace *t, struct bkf_word *xt, Code *ip,
+        i32 depth, Value tos) {
+    unsigned n = atomic_load_explicit(&t->count, memory_order_relaxed);
+    t->entries[n & (BKF_TRACE_SIZE - 1)] = (TraceEntry){
+        .xt = xt, .ip = ip, .depth = depth, .tos = tos
+    };
+    atomic_store_explicit(&t->count, n + 1, memory_order_release);
 }
 
-void w_variable(Processor *p) {
-    Value tmp = { .num = 0 };
-    StringView name = scan_word(&p->scan);
-    Word *w = word_new(name, 0);
+#if BKF_JIT
+// Executable memory holding the native code of a word
+typedef struct {
+    void *code;
+    size_t size;
+} JitBlock;
+
+typedef Word *(*JitFn)(struct bkf_processor *);
+#endif // BKF_JIT
+
+// Words frozen to be shared by processors on different threads. Nothing in
+// them changes anymore, so all of those can read them without locks, and
+// each defines words of its own in a separate index, searched first
+typedef struct frozen {
+    struct frozen *prev; // older words, frozen before
+    struct bkf_processor *owner; // which froze them, and frees them
+    struct bkf_word *dict;   // newest word frozen
+    WordIndex index;
+} Frozen;
+
+// Tasks take turns running in a processor, each on stacks of its own, when
+// the one running pauses. Those not running keep the state of their stacks
+// here, and the processor has the one running. The interpreter itself is a
+// task too, which is always awake
+typedef struct task {
+    struct task *next; // in the ring of tasks of the processor
+    struct task *older; // defined before it, in the list of all of them
+    struct bkf_processor *owner;
+    Stack ds, rs, ls;
+    Code *ip;
+    bool awake; // activated, and not stopped since?
+} Task;
+
+// Code words registered so far. Images refer to their C functions by their
+// index in this table, since the addresses change from one run to the next
+typedef struct {
+    const char *name;
+    CodeWordFn fn;
+} CodeEntry;
 
-    proc_comp_push(p, w, tmp);
-    Value *operand = ds_top(&w->as.colon);
-    ds_push_xt(&w->as.colon, p->w_exit);
-    ds_push(&w->as.colon, tmp);
-    operand->addr = ds_top(&w->as.colon);
+// Most literals in a row that the compiler keeps track of, for folding
+#define COMP_LITS 8
 
-    word_list_add(&p->dict, w);
-}
+// -----------------------------------------------------------------------------
 
-void w_fetch(Processor *p) {
-    Value addr = proc_pop(p);
-    if(p->panic) return;
-    Value val = *addr.addr;
-    ds_push(&p->ds, val);
-}
+typedef struct bkf_processor {
+    Scanner scan;
+    Code *ip;     // instruction pointer
+    Stack ds;     // parameter stack, for general use data
+    Stack rs;     // R stack, for return addresses
+    Stack ls;     // loop stack, with the limit and index of each do loop
+    Output out;
+    struct catch_frame *catcher; // innermost handler of errors
+    int thrown;   // code of the last error caught
+    bool verbose; // verbose error messages?
 
-void w_store(Processor *p) {
-    Value addr = proc_pop(p);
-    if(p->panic) return;
-    Value val = proc_pop(p);
-    *addr.addr = val;
-}
+    // The dictionary space is a single region of memory, reserved up front,
+    // where words and data are laid out one after the other as they are
+    // defined. Nothing in it ever moves
+    uint8_t *space, *space_end;
+    uint8_t *here; // first free byte, which compact code may leave unaligned
+    uint8_t *fence; // the words below it came with the processor, for good
 
-// -----------------------------------------------------------------------------
+    Word *dict;      // word list
+    WordIndex index; // the words of the list not frozen, indexed by name
+    Frozen *frozen;  // the rest of them, newest first
+    struct worker *workers; // spawned from this processor, not joined yet
+    struct bkf_processor *parent; // which spawned this one, if any
+    Task main_task; // the interpreter, as a task
+    Task *task;     // task running
+    Task *tasks;    // defined in the dictionary, newest first
+    Code task_end;  // what tasks return to, when they're done
+    Word *comp_word; // word currently being compiled
+    // The last two instructions compiled into it, candidates for fusion
+    Code *comp_last, *comp_prev;
+    // The instructions before each of the literals compiled last, one after
+    // the other, which pure operations following them are folded into
+    Code *comp_lits[COMP_LITS];
+    int comp_lit_count;
+    bool comp_straight; // no exits or hand compiled cells so far?
+    // Names of the locals of the word being compiled, in their frame order
+    StringView locals[BKF_LOCALS_MAX];
+    int local_count;
+    int inline_max;     // largest body inlined without being asked to
+    int *fusion_hits; // how many times each fusion rule was applied
+#ifdef BKF_PAIR_STATS
+    PairCount *pairs;
+#endif // BKF_PAIR_STATS
+
+    CodeEntry *codes;
+    int code_count, code_cap;
+    // Kernels of the words on ranges of cells, for the CPU running them
+    const struct kernels *kernels;
+
+    uint32_t jit_threshold; // calls before compiling a word, or 0 for never
+    bool profiling;         // time the words run from now on?
+    Profile prof;
+    bool tracing;           // record the instructions run from now on?
+    bool trace_handled;     // counted among the users of the handlers?
+    Trace trace;
+#if BKF_JIT
+    JitBlock *jit_blocks;
+    int jit_count, jit_cap;
+#endif // BKF_JIT
 
-void w_dup(Processor *p) {
-    Value n = proc_pop(p);
-    ds_push(&p->ds, n);
-    ds_push(&p->ds, n);
+    // Address of a couple significant words
+    Word *w_exit;
+    Word *w_push;
+    Word *w_tail;
+    Word *prims[OP_count]; // the word of each primitive
+#if BKF_COMPACT
+    Word **tokens; // the words of compact code, by token
+    int token_count;
+#endif // BKF_COMPACT
+} Processor;
+
+void load_builtin(Processor *p);
+const struct kernels *kernels_pick(void);
+void proc_locals_clear(Processor *p);
+
+// Sets up a processor without any words
+void proc_setup(Processor *p, int ds_size, int rs_size, int dict_size) {
+    p->ip = NULL;
+    stack_init(&p->ds, ds_size);
+    stack_init(&p->rs, rs_size);
+    stack_init(&p->ls, 2 * BKF_LS_DEPTH);
+    out_init(&p->out, stdout);
+    p->catcher = NULL;
+    p->thrown = 0;
+    p->verbose = false;
+
+    p->space = p->here = p->fence = space_reserve(dict_size * sizeof(Value));
+    p->space_end = p->space + dict_size * sizeof(Value);
+
+    p->codes = NULL;
+    p->code_count = p->code_cap = 0;
+    p->kernels = kernels_pick();
+
+    p->dict = NULL;
+    index_init(&p->index);
+    p->frozen = NULL;
+    p->workers = NULL;
+    p->parent = NULL;
+    p->main_task = (Task){
+        .next = &p->main_task, .owner = p,
+        .ds = p->ds, .rs = p->rs, .ls = p->ls, .awake = true
+    };
+    p->task = &p->main_task;
+    p->tasks = NULL;
+    p->comp_word = NULL;
+    p->comp_last = p->comp_prev = NULL;
+    p->comp_lit_count = 0;
+    p->comp_straight = false;
+    p->local_count = 0;
+    p->inline_max = BKF_INLINE_MAX;
+    p->fusion_hits = get_mem(FUSION_COUNT * sizeof(*p->fusion_hits));
+    memset(p->fusion_hits, 0, FUSION_COUNT * sizeof(*p->fusion_hits));
+#ifdef BKF_PAIR_STATS
+    p->pairs = get_mem(PAIRS_SIZE * sizeof(*p->pairs));
+    memset(p->pairs, 0, PAIRS_SIZE * sizeof(*p->pairs));
+#endif // BKF_PAIR_STATS
+    memset(p->prims, 0, sizeof(p->prims));
+#if BKF_COMPACT
+    p->tokens = get_mem(CODE_TOKENS * sizeof(*p->tokens));
+    p->token_count = 0;
+#endif // BKF_COMPACT
+    p->jit_threshold = 0;
+    p->profiling = false;
+    profile_init(&p->prof);
+    p->tracing = false;
+    p->trace_handled = false;
+    atomic_init(&p->trace.count, 0);
+#if BKF_JIT
+    p->jit_blocks = NULL;
+    p->jit_count = p->jit_cap = 0;
+#endif // BKF_JIT
 }
 
-void w_swap(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push(&p->ds, n2);
-    ds_push(&p->ds, n1);
+void proc_init(Processor *p, int ds_size, int rs_size, int dict_size) {
+    proc_setup(p, ds_size, rs_size, dict_size);
+    load_builtin(p);
+    p->fence = p->here;
 }
 
-void w_over(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push(&p->ds, n1);
-    ds_push(&p->ds, n2);
-    ds_push(&p->ds, n1);
+bool proc_compile_mode(const Processor *p) {
+    return p->comp_word != NULL;
 }
 
-void w_rot(Processor *p) {
-    Value n3 = proc_pop(p);
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push(&p->ds, n2);
-    ds_push(&p->ds, n3);
-    ds_push(&p->ds, n1);
+void proc_join_all(Processor *p);
+void proc_thaw(Processor *p);
+void trace_uninstall(Processor *p);
+
+void proc_free(Processor *p) {
+    proc_join_all(p);
+    trace_uninstall(p);
+    out_flush(&p->out);
+    stack_free(&p->ds);
+    stack_free(&p->rs);
+    stack_free(&p->ls);
+    space_release(p->space, p->space_end - p->space);
+    index_free(&p->index);
+    proc_thaw(p);
+    free_mem(p->codes);
+    free_mem(p->fusion_hits);
+    proc_locals_clear(p);
+#if BKF_COMPACT
+    free_mem(p->tokens);
+#endif // BKF_COMPACT
+    profile_free(&p->prof);
+#if BKF_JIT
+    for(int i = 0; i < p->jit_count; ++i)
+        munmap(p->jit_blocks[i].code, p->jit_blocks[i].size);
+    free_mem(p->jit_blocks);
+#endif // BKF_JIT
+#ifdef BKF_PAIR_STATS
+    free_mem(p->pairs);
+#endif // BKF_PAIR_STATS
 }
 
-void w_push(Processor *p) {
-    p->ip += 1;
-    Value n = *p->ip;
-    ds_push(&p->ds, n);
+void load_source(Processor *p, StringView source) {
+    scan_init(&p->scan, source);
 }
 
-void w_drop(Processor *p) {
-    proc_pop(p);
+// Puts the stacks of the task running aside, and those of another in place
+void proc_switch(Processor *p, Task *t) {
+    Task *cur = p->task;
+    cur->ds = p->ds;
+    cur->rs = p->rs;
+    cur->ls = p->ls;
+    cur->ip = p->ip;
+    p->ds = t->ds;
+    p->rs = t->rs;
+    p->ls = t->ls;
+    p->ip = t->ip;
+    p->task = t;
 }
 
 // -----------------------------------------------------------------------------
 
-void w_print(Processor *p) {
-    Value val = proc_pop(p);
-    if(p->panic) return;
-    printf("%" PRId32, val.num);
+// Errors don't return: they unwind to the innermost handler, as throws.
+// Handlers are set by catch, and around everything the interpreter runs, so
+// nothing has to check for errors along the way. Each handler keeps the
+// state the stacks are restored to, the data stack only for catch
+typedef struct catch_frame {
+    jmp_buf env;
+    struct catch_frame *prev;
+    Value *ds_sp, *rs_sp, *ls_sp;
+    Code *ip;
+    int prof_depth;
+    Task *task; // which was running
+    bool is_catch; // set by catch, which also keeps errors from being printed
+} CatchFrame;
+
+// Codes thrown by errors, the ones from the standard where it has them
+enum {
+    THROW_abort = -1,
+    THROW_stack_overflow = -3,
+    THROW_stack_underflow = -4,
+    THROW_rs_overflow = -5,
+    THROW_ls_overflow = -7,
+    THROW_dict_overflow = -8,
+    THROW_div_zero = -10,
+    THROW_undefined = -13,
+    THROW_comp_only = -14,
+    THROW_forget = -15,
+    THROW_name_length = -19,
+    THROW_control = -22,
+    THROW_argument = -24,
+    THROW_loop = -26,
+    THROW_nesting = -29,
+    THROW_file = -37,
+    THROW_memory = -59,
+    THROW_worker = -256,
+};
+
+// The processor errors are thrown to when memory runs out
+static _Thread_local Processor *mem_owner = NULL;
+
+// Installs a handler, which setjmp must then be called on. Until it is
+// removed by catch_pop, errors make that setjmp return again, with a
+// nonzero value and the code in p->thrown
+void catch_push(Processor *p, CatchFrame *frame, bool is_catch) {
+    frame->prev = p->catcher;
+    frame->ds_sp = p->ds.sp;
+    frame->rs_sp = p->rs.sp;
+    frame->ls_sp = p->ls.sp;
+    frame->ip = p->ip;
+    frame->prof_depth = p->prof.depth;
+    frame->task = p->task;
+    frame->is_catch = is_catch;
+    p->catcher = frame;
+    mem_owner = p;
 }
 
-void w_print_u32(Processor *p) {
-    Value val = proc_pop(p);
-    if(p->panic) return;
-    printf("%" PRIX32, val.num);
+void catch_pop(Processor *p) {
+    p->catcher = p->catcher->prev;
+    if(p->catcher == NULL) mem_owner = NULL;
 }
 
-void w_print_ch(Processor *p) {
-    Value val = proc_pop(p);
-    if(p->panic) return;
-    printf("%c", val.ch);
+// Whether an error would be caught by catch, rather than by the interpreter
+bool proc_caught(const Processor *p) {
+    return p->catcher != NULL && p->catcher->is_catch;
 }
 
-void w_endline(UNUSED Processor *p) {
-    printf("\n");
+_Noreturn void proc_throw(Processor *p, int code) {
+    CatchFrame *frame = p->catcher;
+    // Errors outside of any handler can only end the program
+    if(frame == NULL) exit(64);
+    catch_pop(p);
+    // An error in a task stops it, and unwinds the task the handler was
+    // installed by, which is what runs next
+    if(frame->task != p->task) {
+        p->task->awake = false;
+        proc_switch(p, frame->task);
+    }
+    if(frame->is_catch) p->ds.sp = frame->ds_sp;
+    p->rs.sp = frame->rs_sp;
+    p->ls.sp = frame->ls_sp;
+    p->ip = frame->ip;
+    profile_unwind(&p->prof, frame->prof_depth);
+    p->thrown = code;
+    longjmp(frame->env, 1);
 }
 
-void w_dump_ds(Processor *p) {
-    bool first = true;
-    for(int i = 0; i < p->ds.count; ++i) {
-        if(!first) printf(" ");
-        else first = false;
-        printf("%" PRId32, p->ds.contents[i].num);
+void proc_trace_dump(Processor *p);
+
+// Errors are reported where they happen, unless catch is going to handle
+// them, while the position in the source is still that of the word at fault
+_Noreturn void error(Processor *p, int code, const char *err_msg) {
+    if(!proc_caught(p)) {
+        out_flush(&p->out);
+        scan_locate(&p->scan);
+        if(p->verbose)
+            fprintf(stderr, "(%d:%d) error: %s\n",
+                    p->scan.line, p->scan.start_col, err_msg);
+        else fprintf(stderr, "%s\n", err_msg);
+        if(p->tracing) proc_trace_dump(p);
     }
-    if(!first) printf("\n");
+    proc_throw(p, code);
 }
 
-// -----------------------------------------------------------------------------
+_Noreturn void error_undef(Processor *p, StringView word) {
+    if(!proc_caught(p)) {
+        out_flush(&p->out);
+        scan_locate(&p->scan);
+        if(p->verbose)
+            fprintf(stderr, "(%d:%d) error: undefined word '%.*s'\n",
+                    p->scan.line, p->scan.start_col, SV_fmt(word));
+        else fprintf(stderr, "%.*s?\n", SV_fmt(word));
+    }
+    proc_throw(p, THROW_undefined);
+}
+
+_Noreturn void error_comp_only(Processor *p, StringView word) {
+    if(!proc_caught(p)) {
+        out_flush(&p->out);
+        scan_locate(&p->scan);
+        if(p->verbose)
+            fprintf(stderr, "(%d:%d) error: word '%.*s' is only valid in definitions\n",
+                    p->scan.line, p->scan.start_col, SV_fmt(word));
+        else fprintf(stderr, "%.*s?\n", SV_fmt(word));
+    }
+    proc_throw(p, THROW_comp_only);
+}
+
+// Running out of memory is an error like any other, when there is a handler
+// for it. Allocations fail without changing anything, so the processor is
+// left in a usable state
+_Noreturn void out_of_memory(void) {
+    if(mem_owner != NULL) error(mem_owner, THROW_memory, "out of memory");
+    fprintf(stderr, "error: out of memory\n");
+    exit(64);
+}
+
+// Reserves space at the end of the dictionary, at the first multiple of
+// align, which must be a power of two
+void *proc_reserve(Processor *p, size_t size, size_t align) {
+    size_t pad = -(uintptr_t)p->here & (align - 1);
+    if(pad + size > (size_t)(p->space_end - p->here))
+        error(p, THROW_dict_overflow, "dictionary full");
+    void *mem = p->here + pad;
+    p->here += pad + size;
+    return mem;
+}
+
+// Reserves space at the end of the dictionary, rounded up to whole cells
+void *proc_allot(Processor *p, size_t size) {
+    size = (size + sizeof(Value) - 1) / sizeof(Value) * sizeof(Value);
+    return proc_reserve(p, size, sizeof(Value));
+}
+
+// Appends a cell to the dictionary
+Value *proc_comma(Processor *p, Value val) {
+    Value *cell = proc_allot(p, sizeof(val));
+    *cell = val;
+    return cell;
+}
+
+// Appends a cell of threaded code. While a word is being compiled, that
+// is the end of its body
+Code *proc_comma_code(Processor *p, Code c) {
+    Code *cell = proc_reserve(p, sizeof(c), sizeof(c));
+    *cell = c;
+    return cell;
+}
+
+// Threaded code refers to a word by its address or, if compact, by its
+// token
+static inline Code code_cell(Word *w) {
+#if BKF_COMPACT
+    return w->token;
+#else
+    return (Value){ .xt = w };
+#endif // BKF_COMPACT
+}
+
+static inline Word *code_xt(const Processor *p, Code c) {
+#if BKF_COMPACT
+    return p->tokens[c];
+#else
+    (void) p;
+    return c.xt;
+#endif // BKF_COMPACT
+}
+
+#if BKF_COMPACT
+// Operands of compact code that are values take a single cell if they are
+// numbers that fit in it. Other numbers follow CODE_WIDE, in two cells, and
+// anything else, like addresses, follows CODE_FULL, as the bits of the whole
+// value. Numbers are values with nothing set but num
+# define CODE_WIDE INT16_MIN
+# define CODE_FULL (INT16_MIN + 1)
+# define CODE_VALUE_CELLS (sizeof(Value) / sizeof(Code))
+
+_Static_assert(sizeof(Value) == sizeof(uintptr_t), "values must be pointers");
+
+// Reads the value at *ip, and moves past it
+static inline Value code_read(Code **ip) {
+    int16_t n = (int16_t)**ip;
+    uintptr_t bits;
+    if(n > CODE_FULL) {
+        bits = (uint32_t)(i32)n;
+        *ip += 1;
+    } else if(n == CODE_WIDE) {
+        bits = (*ip)[1] | (uint32_t)(*ip)[2] << 16;
+        *ip += 3;
+    } else {
+        memcpy(&bits, *ip + 1, sizeof(bits));
+        *ip += 1 + CODE_VALUE_CELLS;
+    }
+    Value v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+#endif // BKF_COMPACT
+
+// Appends a value as an operand, in the whole cells of a value if full is
+// set, so that it can be replaced by any other with code_patch
+Code *proc_comma_value(Processor *p, Value v, bool full) {
+#if BKF_COMPACT
+    uintptr_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    if(!full && bits == (uint32_t)v.num) {
+        if(v.num > CODE_FULL && v.num <= INT16_MAX)
+            return proc_comma_code(p, (uint16_t)v.num);
+        Code *operand = proc_comma_code(p, (uint16_t)CODE_WIDE);
+        proc_comma_code(p, (uint32_t)v.num & 0xFFFF);
+        proc_comma_code(p, (uint32_t)v.num >> 16);
+        return operand;
+    }
+    Code *operand = proc_comma_code(p, (uint16_t)CODE_FULL);
+    Code *cells = proc_reserve(p, sizeof(v), sizeof(Code));
+    memcpy(cells, &bits, sizeof(bits));
+    return operand;
+#else
+    (void) full;
+    return proc_comma(p, v);
+#endif // BKF_COMPACT
+}
+
+void code_patch(Code *operand, Value v) {
+#if BKF_COMPACT
+    memcpy(operand + 1, &v, sizeof(v));
+#else
+    *operand = v;
+#endif // BKF_COMPACT
+}
+
+// Appends the operand of an instruction with the operation op. Compact
+// code has branch offsets and the words of tail calls in a cell each
+Code *proc_comma_operand(Processor *p, Opcode op, Value v) {
+#if BKF_COMPACT
+    if(op == OP_tail) return proc_comma_code(p, v.xt->token);
+    if(op_branches(op)) return proc_comma_code(p, (uint16_t)v.num);
+#else
+    (void) op;
+#endif // BKF_COMPACT
+    return proc_comma_value(p, v, false);
+}
+
+// An instruction of threaded code, decoded
+typedef struct {
+    Word *xt;
+    Value arg; // the operand, if the operation has one
+    int len;   // in cells, the operand included
+} Instr;
+
+Instr code_decode(const Processor *p, Code *ip) {
+    Instr in = { .xt = code_xt(p, *ip), .arg = { .num = 0 }, .len = 1 };
+    Opcode op = in.xt->op;
+    if(op_operands[op] == 0) return in;
+#if BKF_COMPACT
+    Code *operand = ip + 1;
+    if(op == OP_tail) in.arg.xt = p->tokens[*operand++];
+    else if(op_branches(op)) in.arg.num = (int16_t)*operand++;
+    else in.arg = code_read(&operand);
+    in.len = operand - ip;
+#else
+    in.arg = ip[1];
+    in.len = 2;
+#endif // BKF_COMPACT
+    return in;
+}
+
+// Length of the body of a colon word, in cells, up to the exit that ends
+// it, which is the last one no branch jumps over. It is -1 if the body runs
+// past limit first
+int word_body_len(const Processor *p, const Word *w, const Code *limit) {
+    Code *body = w->as.body;
+    int len = 0, reach = 0;
+    for(;;) {
+        if(body + len >= limit) return -1;
+        Instr in = code_decode(p, &body[len]);
+        Opcode op = in.xt->op;
+        if(op_branches(op)) {
+            int target = len + 1 + in.arg.num;
+            if(target < 0) return -1;
+            if(target > reach) reach = target;
+        }
+        len += in.len;
+        if(op_ends(op) && len > reach) return len;
+    }
+}
+
+// Lays out a new word in the dictionary, and adds it to the word list
+Word *proc_create(Processor *p, StringView name, uint8_t flags) {
+    if(proc_compile_mode(p))
+        error(p, THROW_nesting, "can't define words inside a definition");
+#if BKF_COMPACT
+    if(p->token_count == CODE_TOKENS)
+        error(p, THROW_dict_overflow, "too many words for compact code");
+#endif // BKF_COMPACT
+    if(name.len > WORD_NAME_MAX)
+        error(p, THROW_name_length, "word names are at most 255 characters");
+    Word *w = proc_allot(p, sizeof(*w) + name.len + 1);
+    char *text = (char*)(w + 1);
+    memcpy(text, name.text, name.len);
+    text[name.len] = '\0';
+
+    w->next_hash = NULL;
+    w->name_len = name.len;
+    w->hash = sv_hash(name);
+    w->flags = flags;
+    w->effect = EFFECT_UNKNOWN;
+    if(check_flag(flags, FLAG_code)) {
+        w->op = OP_code;
+        w->as.code = NULL;
+    } else {
+        w->op = OP_colon;
+        w->as.body = (Code*)p->here;
+    }
+#if BKF_COMPACT
+    w->token = p->token_count;
+    p->tokens[p->token_count++] = w;
+#endif // BKF_COMPACT
+#if BKF_JIT
+    w->calls = 0;
+    w->native = NULL;
+#endif // BKF_JIT
+    word_list_add(&p->dict, w);
+    index_add(&p->index, w);
+    return w;
+}
+
+Word *proc_find(const Processor *p, StringView name) {
+    Word *w = index_find(&p->index, name);
+    for(const Frozen *f = p->frozen; w == NULL && f != NULL; f = f->prev)
+        w = index_find(&f->index, name);
+    return w;
+}
+
+// Freezes the words defined so far, moving them to a layer of their own, so
+// that the processors spawned from now on can share them. This one only
+// reads them from then on, like the others
+void proc_freeze(Processor *p) {
+    if(p->index.count == 0) return;
+    if(proc_compile_mode(p))
+        error(p, THROW_nesting, "can't freeze words inside a definition");
+    Frozen *f = get_mem(sizeof(*f));
+#if BKF_JIT
+    // Frozen words aren't compiled to native code anymore, which would
+    // change them: their counts of calls are put past any threshold
+    Word *older = p->frozen != NULL ? p->frozen->dict : NULL;
+    for(Word *w = p->dict; w != older; w = w->prev) w->calls = UINT32_MAX;
+#endif // BKF_JIT
+    *f = (Frozen){
+        .prev = p->frozen, .owner = p, .dict = p->dict, .index = p->index
+    };
+    p->frozen = f;
+    index_init(&p->index);
+}
+
+// Drops the layers of words this processor froze, once nothing shares them
+// anymore. The words are still in the word list, to be indexed again
+void proc_thaw(Processor *p) {
+    while(p->frozen != NULL && p->frozen->owner == p) {
+        Frozen *f = p->frozen;
+        p->frozen = f->prev;
+        index_free(&f->index);
+        free_mem(f);
+    }
+}
+
+void proc_register_code(Processor *p, const char *name, CodeWordFn fn) {
+    if(p->code_count + 1 > p->code_cap) {
+        p->code_cap = (p->code_cap == 0) ? 64 : p->code_cap * 2;
+        p->codes = realloc_mem(p->codes, p->code_cap * sizeof(*p->codes));
+    }
+    p->codes[p->code_count++] = (CodeEntry){ .name = name, .fn = fn };
+}
+
+// Indexes the words again, from the oldest to the newest
+void proc_reindex(Processor *p) {
+    int count = 0;
+    for(Word *w = p->dict; w != NULL; w = w->prev) count += 1;
+    Word **words = get_mem((count + 1) * sizeof(*words));
+    int i = count;
+    for(Word *w = p->dict; w != NULL; w = w->prev) words[--i] = w;
+    index_free(&p->index);
+    index_init(&p->index);
+    for(i = 0; i < count; ++i) index_add(&p->index, words[i]);
+    free_mem(words);
+}
+
+static inline bool points_into(const void *ptr, const void *start,
+        const void *end) {
+    uintptr_t at = (uintptr_t)ptr;
+    return at >= (uintptr_t)start && at < (uintptr_t)end;
+}
+
+// Whether the code run from ip, with the R stack rs, is in the middle of
+// any word between start and end: if ip, a return address or a native word
+// on the R stack is there
+bool code_runs_in(const Code *ip, const Stack *rs, const void *start,
+        const void *end) {
+    if(points_into(ip, start, end)) return true;
+    for(const Value *v = rs->base; v <= rs->sp; ++v)
+        if(points_into(v->addr, start, end)) return true;
+    return false;
+}
 
-void w_add(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, n1.num + n2.num);
+// Forgets a word and every word defined after it, taking back all of the
+// dictionary space from its header on at once. Words frozen, those that
+// came with the processor and those running can't be forgotten
+void proc_forget(Processor *p, Word *w) {
+    if(proc_compile_mode(p))
+        error(p, THROW_nesting, "can't forget words inside a definition");
+    if((uint8_t*)w < p->fence)
+        error(p, THROW_forget, "can't forget builtin words");
+    Word *older = p->frozen != NULL ? p->frozen->dict : NULL, *v = p->dict;
+    while(v != w && v != older) v = v->prev;
+    if(v != w || w == older)
+        error(p, THROW_forget, "can't forget words shared with workers");
+
+    // The state of the task running is in the processor, not in the task
+    void *start = w, *end = p->here;
+    if(points_into(p->task, start, end)
+            || code_runs_in(p->ip, &p->rs, start, end))
+        error(p, THROW_forget, "can't forget words that are running");
+    for(Task *t = p->task->next; t != p->task; t = t->next)
+        if(!points_into(t, start, end) && t->awake
+                && code_runs_in(t->ip, &t->rs, start, end))
+            error(p, THROW_forget, "can't forget words a task is running");
+
+    // Tasks defined after the word are taken out of the ring, and the list
+    for(Task *t = p->task; t->next != p->task; ) {
+        if(points_into(t->next, start, end)) t->next = t->next->next;
+        else t = t->next;
+    }
+    while(p->tasks != NULL && points_into(p->tasks, start, end))
+        p->tasks = p->tasks->older;
+    for(v = p->dict; v != w->prev; v = v->prev) {
+        index_remove(&p->index, v);
+#if BKF_JIT
+        if(v->op != OP_jit) continue;
+        for(int i = 0; i < p->jit_count; ++i) {
+            JitBlock *b = &p->jit_blocks[i];
+            if(b->code != (void*)(uintptr_t)v->native) continue;
+            munmap(b->code, b->size);
+            *b = p->jit_blocks[--p->jit_count];
+            break;
+        }
+#endif // BKF_JIT
+    }
+    if(p->prof.count > 0)
+        profile_rehash(&p->prof, p->prof.size, (uintptr_t)start,
+                (uintptr_t)end);
+    // The trace would name words that are gone
+    atomic_store(&p->trace.count, 0);
+#if BKF_COMPACT
+    p->token_count = w->token;
+#endif // BKF_COMPACT
+    p->dict = w->prev;
+    p->here = (uint8_t*)w;
+}
+
+Value proc_pop(Processor *p) {
+    if(p->ds.sp < p->ds.base)
+        error(p, THROW_stack_underflow, "stack underflow");
+    return *p->ds.sp--;
+}
+
+void proc_push(Processor *p, Value v) {
+    if(p->ds.sp >= p->ds.limit)
+        error(p, THROW_stack_overflow, "stack overflow");
+    *++p->ds.sp = v;
 }
 
-void w_sub(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, n1.num - n2.num);
+// -----------------------------------------------------------------------------
+
+// Switching tasks is up to each of them, at pause. The inner interpreter
+// doesn't use the C stack for colon words, so each task's state is all in
+// its stacks and ip, and switching is just swapping those. Only the loop
+// running the word the interpreter was given switches them, though: the
+// stacks can't be swapped from under a nested one, as run by catch or by
+// native code, which would have to return on the C stack first
+
+// Makes a task run the threaded code at ip on fresh stacks, once it gets
+// its turn. It returns to task_end when done, which stops it
+void proc_activate(Processor *p, Task *t, Code *ip) {
+    if(t->owner != p)
+        error(p, THROW_argument, "task belongs to another processor");
+    if(t == p->task) error(p, THROW_argument, "task is running");
+    t->ds.sp = t->ds.base - 1;
+    t->ls.sp = t->ls.base - 1;
+    t->rs.sp = t->rs.base;
+    p->task_end = code_cell(p->prims[OP_stop]);
+    t->rs.sp->addr = (Value*)&p->task_end;
+    t->ip = ip;
+    t->awake = true;
+    if(t->next == NULL) {
+        t->next = p->task->next;
+        p->task->next = t;
+    }
 }
 
-void w_mul(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, n1.num * n2.num);
+// Switches to the next task awake, if there is one other than the task
+// running, and the loop whose bottom frame is rbase may. Returns whether
+bool proc_pause(Processor *p, const Value *rbase) {
+    if(rbase != p->main_task.rs.base - 1 || proc_caught(p)) return false;
+    Task *t = p->task->next;
+    while(!t->awake) t = t->next;
+    if(t == p->task) return false;
+    proc_switch(p, t);
+    return true;
 }
 
-void w_div(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, n1.num * n2.num);
+// Puts the task running to sleep until activated again, and switches to
+// the next
+void proc_stop(Processor *p, const Value *rbase) {
+    if(p->task == &p->main_task)
+        error(p, THROW_argument, "the interpreter can't stop");
+    if(rbase != p->main_task.rs.base - 1 || proc_caught(p))
+        error(p, THROW_argument, "can't stop a task here");
+    p->task->awake = false;
+    proc_pause(p, rbase);
 }
 
 // -----------------------------------------------------------------------------
@@ -705,96 +1951,4067 @@ void w_div(Processor *p) {
 // This makes the bitwise operators behave like the standard logic ones
 #define flag(cond) ((cond) ? -1 : 0)
 
-void w_less(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num < n2.num));
+// The inner interpreter. Nested colon words don't recurse through the C
+// stack: their return addresses are kept in the R stack, and a single loop
+// runs until the word that was called initially exits. The most common
+// primitives are implemented by the loop itself; they are dispatched using
+// computed gotos if BKF_THREADED is set, or a portable switch otherwise.
+// While running, the top of the data stack is cached in tos, and the stack
+// pointers are kept in local variables; they are written back before any
+// code word is called
+#if BKF_JIT
+bool jit_compile(Processor *p, Word *w);
+void jit_call(Processor *p, Word *w);
+#endif // BKF_JIT
+
+void execute_word(Processor *p, Word *w) {
+    if(w->op == OP_code) {
+        bool profiling = p->profiling;
+        if(profiling) profile_enter(&p->prof, w);
+        w->as.code(p);
+        if(profiling) profile_leave(&p->prof);
+        return;
+    }
+    if(p->rs.sp >= p->rs.limit)
+        error(p, THROW_rs_overflow, "return stack overflow");
+
+    // The word is called from a small piece of threaded code, so that the
+    // loop only has to stop when it exits
+    Code entry[2] = { code_cell(w), code_cell(p->w_exit) };
+    Value *const rbase = p->rs.sp;
+    Value *rp = rbase;
+    (++rp)->addr = (Value*)p->ip;
+    Code *ip = entry;
+    Value *sp = p->ds.sp;
+    Value tos = *sp;
+    // The index of the innermost loop is at lp, with its limit below it
+    Value *lp = p->ls.sp;
+
+// Underflow is only checked by operations that consume cells, and overflow
+// only by the ones that produce them, each with a single comparison
+#define NEEDS(n) if(sp < p->ds.base + (n) - 1) goto underflow
+#define ROOM(n) if(sp + (n) > p->ds.limit) goto overflow
+#define PUSH(v) do { Value v_ = (v); *sp++ = tos; tos = v_; } while(0)
+#define SAVE() \
+    (*sp = tos, p->ds.sp = sp, p->rs.sp = rp, p->ls.sp = lp, p->ip = ip)
+#define LOAD() \
+    (sp = p->ds.sp, tos = *sp, rp = p->rs.sp, lp = p->ls.sp, ip = p->ip)
+#define BINARY(expr) \
+    do { \
+        i32 n1 = sp[-1].num, n2 = tos.num; \
+        tos.num = (expr); \
+        sp -= 1; \
+    } while(0)
+
+#ifdef BKF_PAIR_STATS
+    Word *last = NULL;
+# define COUNT_PAIR() \
+    (last != NULL ? pairs_count(p->pairs, last, w) : (void)0, last = w)
+# define RESET_PAIR() (last = NULL)
+#else
+# define COUNT_PAIR() ((void)0)
+# define RESET_PAIR() ((void)0)
+#endif // BKF_PAIR_STATS
+// Compact code has the tokens of words, to be looked up in their table, and
+// operands of any length
+#if BKF_COMPACT
+    Word *const *const tokens = p->tokens;
+# define XT(c) tokens[c]
+# define OPERAND() code_read(&ip)
+# define OFFSET() ((int16_t)*ip)
+#else
+# define XT(c) (c).xt
+# define OPERAND() (*ip++)
+# define OFFSET() (ip->num)
+#endif // BKF_COMPACT
+#define FETCH() (w = XT(*ip++), COUNT_PAIR(), w)
+#define TRACE() trace_record(&p->trace, w, ip - 1, sp - p->ds.base + 1, tos)
+
+#if BKF_THREADED
+    // Profiling swaps the operations that enter and leave words for ones
+    // that also time them, in a table of its own, so it costs nothing when
+    // it is off
+# if BKF_JIT
+#  define JIT_ENTRY(jit) [OP_jit] = &&jit,
+# else
+#  define JIT_ENTRY(jit)
+# endif // BKF_JIT
+    //
+    // Words whose effect is known run without stack checks, in a table that
+    // skips them: x is the prefix of the labels of the operations, op_ for
+    // the checked versions and fast_ for the ones after their checks
+# define OP_TABLE(code, colon, safe, exit, tail, jit, x) { \
+        [OP_code]       = &&code, \
+        [OP_colon]      = &&colon, \
+        [OP_safe]       = &&safe, \
+        [OP_constant]   = &&x##constant, \
+        [OP_marker]     = &&x##marker, \
+        [OP_exit]       = &&exit, \
+        [OP_push]       = &&x##push, \
+        [OP_tail]       = &&tail, \
+        [OP_branch]     = &&op_branch, \
+        [OP_zero_branch] = &&x##zero_branch, \
+        [OP_do]         = &&x##do, \
+        [OP_loop]       = &&op_loop, \
+        [OP_plus_loop]  = &&x##plus_loop, \
+        [OP_loop_i]     = &&x##loop_i, \
+        [OP_loop_j]     = &&x##loop_j, \
+        [OP_unloop]     = &&op_unloop, \
+        [OP_execute]    = &&x##execute, \
+        [OP_pause]      = &&op_pause, \
+        [OP_stop]       = &&op_stop, \
+        [OP_activate]   = &&x##activate, \
+        [OP_frame]      = &&x##frame, \
+        [OP_local_fetch] = &&x##local_fetch, \
+        [OP_local_store] = &&x##local_store, \
+        [OP_leave]      = &&x##leave, \
+        JIT_ENTRY(jit) \
+        [OP_fetch]      = &&x##fetch, \
+        [OP_store]      = &&x##store, \
+        [OP_index]      = &&x##index, \
+        [OP_dup]        = &&x##dup, \
+        [OP_drop]       = &&x##drop, \
+        [OP_swap]       = &&x##swap, \
+        [OP_over]       = &&x##over, \
+        [OP_rot]        = &&x##rot, \
+        [OP_add]        = &&x##add, \
+        [OP_sub]        = &&x##sub, \
+        [OP_mul]        = &&x##mul, \
+        [OP_div]        = &&x##div, \
+        [OP_less]       = &&x##less, \
+        [OP_less_eq]    = &&x##less_eq, \
+        [OP_greater]    = &&x##greater, \
+        [OP_greater_eq] = &&x##greater_eq, \
+        [OP_equals]     = &&x##equals, \
+        [OP_not_eq]     = &&x##not_eq, \
+        [OP_and]        = &&x##and, \
+        [OP_or]         = &&x##or, \
+        [OP_xor]        = &&x##xor, \
+        [OP_zero_equals] = &&x##zero_equals, \
+        [OP_nip]        = &&x##nip, \
+        [OP_two_dup]    = &&x##two_dup, \
+        [OP_lit_add]    = &&x##lit_add, \
+        [OP_lit_sub]    = &&x##lit_sub, \
+        [OP_lit_less]   = &&x##lit_less, \
+        [OP_lit_equals] = &&x##lit_equals, \
+        [OP_lit_fetch]  = &&x##lit_fetch, \
+        [OP_lit_store]  = &&x##lit_store, \
+        [OP_dup_fetch]  = &&x##dup_fetch, \
+        [OP_swap_store] = &&x##swap_store, \
+        [OP_over_add]   = &&x##over_add, \
+        [OP_dup_fetch_lit_add] = &&x##dup_fetch_lit_add, \
+        [OP_lit_add_store] = &&x##lit_add_store, \
+    }
+    static void *const plain[OP_count] = OP_TABLE(op_code, op_colon,
+            op_safe, op_exit, op_tail, op_jit, op_);
+    static void *const profiled[OP_count] = OP_TABLE(prof_code, prof_colon,
+            op_safe, prof_exit, prof_tail, prof_jit, op_);
+    static void *const unchecked[OP_count] = OP_TABLE(op_code, op_colon,
+            fast_safe, fast_exit, fast_tail, op_jit, fast_);
+# undef OP_TABLE
+# undef JIT_ENTRY
+    // Tracing puts a table in front of the others, which records each
+    // instruction and then runs it
+    static void *const traced[OP_count] = { [0 ... OP_count - 1] = &&trace };
+    void *const *const untraced = p->profiling ? profiled : plain;
+    void *const *dispatch = p->tracing ? traced : untraced;
+    // Position of the R stack below the frame of the outermost word running
+    // unchecked, where the plain table takes over again
+    Value *rsafe = NULL;
+# define CODE(op) op_##op:
+# define FAST(op) fast_##op:
+# define NEXT() goto *dispatch[FETCH()->op]
+# define DISPATCH() goto *dispatch[w->op]
+# define PROFILED(label)
+    NEXT();
+#else
+    // Without a table to swap, the operations that enter and leave words
+    // have to check whether profiling is on, and every one whether tracing is
+    const bool profiling = p->profiling, tracing = p->tracing;
+# define CODE(op) case OP_##op:
+# define FAST(op)
+# define NEXT() continue
+# define DISPATCH() goto dispatch
+# define PROFILED(label) if(profiling) goto label
+    for(;;) {
+    (void)FETCH();
+dispatch:
+    if(tracing) TRACE();
+    switch(w->op) {
+#endif // BKF_THREADED
+
+    CODE(code)
+        PROFILED(prof_code);
+        SAVE();
+        w->as.code(p);
+        LOAD();
+        NEXT();
+#if BKF_JIT
+    // Words called often enough are compiled to native code
+# define JIT_COUNT() \
+    if(w->calls < p->jit_threshold && ++w->calls == p->jit_threshold \
+            && jit_compile(p, w)) \
+        DISPATCH()
+#else
+# define JIT_COUNT() ((void)0)
+#endif // BKF_JIT
+    CODE(safe)
+        // The stack is checked once for the whole word, which then runs
+        // unchecked along with the words it calls, where there is a table
+        // for that: not in the portable switch, nor while timing or tracing
+        NEEDS(w->effect.in);
+        ROOM(w->effect.grow);
+#if BKF_THREADED
+        if(dispatch == plain) {
+            JIT_COUNT();
+            rsafe = rp;
+            dispatch = unchecked;
+            goto enter_colon;
+        }
+        if(untraced == profiled) goto prof_colon;
+#endif // BKF_THREADED
+        goto enter_word;
+    CODE(colon)
+    enter_word:
+        PROFILED(prof_colon);
+        JIT_COUNT();
+    enter_colon:
+        if(rp >= p->rs.limit) {
+            SAVE();
+            error(p, THROW_rs_overflow, "return stack overflow");
+        }
+        (++rp)->addr = (Value*)ip;
+        ip = w->as.body;
+        RESET_PAIR();
+        NEXT();
+    CODE(exit)
+        PROFILED(prof_exit);
+    leave_colon:
+        ip = (Code*)(rp--)->addr;
+        if(rp == rbase) goto done;
+        RESET_PAIR();
+        NEXT();
+    CODE(push)
+        ROOM(1);
+        FAST(push);
+        PUSH(OPERAND());
+        NEXT();
+    CODE(constant)
+        ROOM(1);
+        FAST(constant);
+        PUSH(w->as.value);
+        NEXT();
+    CODE(marker)
+        FAST(marker);
+        SAVE();
+        proc_forget(p, w);
+        LOAD();
+        NEXT();
+    CODE(tail)
+        PROFILED(prof_tail);
+    tail_call:
+        // The frame of the current word is dropped before the call, so the
+        // return stack doesn't grow
+        w = XT(*ip);
+        ip = (Code*)(rp--)->addr;
+        DISPATCH();
+#if BKF_JIT
+    CODE(jit)
+        PROFILED(prof_jit);
+        if(rp >= p->rs.limit) {
+            SAVE();
+            error(p, THROW_rs_overflow, "return stack overflow");
+        }
+        // The cell taken holds the word, as in jit_call, since ip is kept
+        // here meanwhile
+        (++rp)->xt = w;
+        SAVE();
+        w = w->native(p);
+        LOAD();
+        rp -= 1;
+        // The native code may leave a tail call to be made here
+        if(w != NULL) DISPATCH();
+        NEXT();
+#endif // BKF_JIT
+    // Branch offsets are in cells, from the operand itself
+    CODE(branch)
+        ip += OFFSET();
+        NEXT();
+    CODE(zero_branch)
+        NEEDS(1);
+        FAST(zero_branch);
+        ip += tos.num == 0 ? OFFSET() : 1;
+        tos = *--sp;
+        NEXT();
+    CODE(do)
+        NEEDS(2);
+        FAST(do);
+        if(lp + 2 > p->ls.limit) {
+            SAVE();
+            error(p, THROW_ls_overflow, "loop stack overflow");
+        }
+        lp[1] = sp[-1];
+        lp[2] = tos;
+        lp += 2;
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+    CODE(loop)
+        lp->num = (i32)((uint32_t)lp->num + 1);
+        if(lp->num != lp[-1].num) ip += OFFSET();
+        else {
+            ip += 1;
+            lp -= 2;
+        }
+        NEXT();
+    CODE(plus_loop) {
+        NEEDS(1);
+        FAST(plus_loop);
+        // The loop ends when the index crosses the boundary between the
+        // limit and the cell before it, in either direction
+        uint32_t step = tos.num;
+        uint32_t diff = (uint32_t)lp->num - (uint32_t)lp[-1].num;
+        tos = *--sp;
+        lp->num = (i32)((uint32_t)lp->num + step);
+        if((i32)(diff ^ (diff + step)) >= 0 || (i32)(diff ^ step) >= 0)
+            ip += OFFSET();
+        else {
+            ip += 1;
+            lp -= 2;
+        }
+        NEXT();
+    }
+    CODE(loop_i)
+        ROOM(1);
+        FAST(loop_i);
+        PUSH(*lp);
+        NEXT();
+    CODE(loop_j)
+        ROOM(1);
+        FAST(loop_j);
+        PUSH(lp[-2]);
+        NEXT();
+    CODE(unloop)
+        if(lp < p->ls.base) {
+            SAVE();
+            error(p, THROW_loop, "unloop outside of a loop");
+        }
+        lp -= 2;
+        NEXT();
+    CODE(frame) {
+        FAST(frame);
+        Value arg = OPERAND();
+        int cells = arg.num >> 8, init = arg.num & 0xFF;
+        NEEDS(init);
+        if(rp + cells > p->rs.limit) {
+            SAVE();
+            error(p, THROW_rs_overflow, "return stack overflow");
+        }
+        *sp = tos;
+        sp -= init;
+        for(int i = 1; i <= init; ++i) rp[i] = sp[i];
+        for(int i = init + 1; i <= cells; ++i) rp[i].num = 0;
+        rp += cells;
+        tos = *sp;
+        NEXT();
+    }
+    CODE(local_fetch)
+        ROOM(1);
+        FAST(local_fetch);
+        PUSH(rp[-OPERAND().num]);
+        NEXT();
+    CODE(local_store)
+        NEEDS(1);
+        FAST(local_store);
+        rp[-OPERAND().num] = tos;
+        tos = *--sp;
+        NEXT();
+    CODE(leave)
+        FAST(leave);
+        rp -= OPERAND().num;
+        w = p->w_exit;
+        DISPATCH();
+#if BKF_THREADED
+    // The stack was checked on entry to the word running unchecked for the
+    // task that was running then, so the next one goes back to the checks
+# define CHECKED() if(dispatch == unchecked) dispatch = plain
+#else
+# define CHECKED() ((void)0)
+#endif // BKF_THREADED
+    CODE(execute)
+        NEEDS(1);
+        FAST(execute);
+        w = tos.xt;
+        tos = *--sp;
+        DISPATCH();
+    CODE(pause)
+        SAVE();
+        if(proc_pause(p, rbase)) {
+            LOAD();
+            CHECKED();
+        }
+        NEXT();
+    CODE(stop)
+        SAVE();
+        proc_stop(p, rbase);
+        LOAD();
+        CHECKED();
+        NEXT();
+    CODE(activate) {
+        NEEDS(1);
+        FAST(activate);
+        // The rest of the word runs in the task, and the word exits here
+        Task *t = (Task*)tos.addr;
+        tos = *--sp;
+        SAVE();
+        proc_activate(p, t, ip);
+        w = p->w_exit;
+        DISPATCH();
+    }
+    CODE(fetch)
+        NEEDS(1);
+        FAST(fetch);
+        tos = *tos.addr;
+        NEXT();
+    CODE(store)
+        NEEDS(2);
+        FAST(store);
+        *tos.addr = sp[-1];
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+    CODE(index)
+        NEEDS(2);
+        FAST(index);
+        tos.addr = sp[-1].addr + tos.num;
+        sp -= 1;
+        NEXT();
+    CODE(dup)
+        NEEDS(1);
+        ROOM(1);
+        FAST(dup);
+        PUSH(tos);
+        NEXT();
+    CODE(drop)
+        NEEDS(1);
+        FAST(drop);
+        tos = *--sp;
+        NEXT();
+    CODE(swap) {
+        NEEDS(2);
+        FAST(swap);
+        Value n1 = sp[-1];
+        sp[-1] = tos;
+        tos = n1;
+        NEXT();
+    }
+    CODE(over)
+        NEEDS(2);
+        ROOM(1);
+        FAST(over);
+        PUSH(sp[-1]);
+        NEXT();
+    CODE(rot) {
+        NEEDS(3);
+        FAST(rot);
+        Value n1 = sp[-2];
+        sp[-2] = sp[-1];
+        sp[-1] = tos;
+        tos = n1;
+        NEXT();
+    }
+    CODE(add)
+        NEEDS(2);
+        FAST(add);
+        BINARY(n1 + n2);
+        NEXT();
+    CODE(sub)
+        NEEDS(2);
+        FAST(sub);
+        BINARY(n1 - n2);
+        NEXT();
+    CODE(mul)
+        NEEDS(2);
+        FAST(mul);
+        BINARY(n1 * n2);
+        NEXT();
+    CODE(div)
+        NEEDS(2);
+        FAST(div);
+        if(tos.num == 0) {
+            SAVE();
+            error(p, THROW_div_zero, "division by zero");
+        }
+        // Dividing by -1 negates, and so wraps around like the rest
+        BINARY(n2 == -1 ? (i32)(0u - (uint32_t)n1) : n1 / n2);
+        NEXT();
+    CODE(less)
+        NEEDS(2);
+        FAST(less);
+        BINARY(flag(n1 < n2));
+        NEXT();
+    CODE(less_eq)
+        NEEDS(2);
+        FAST(less_eq);
+        BINARY(flag(n1 <= n2));
+        NEXT();
+    CODE(greater)
+        NEEDS(2);
+        FAST(greater);
+        BINARY(flag(n1 > n2));
+        NEXT();
+    CODE(greater_eq)
+        NEEDS(2);
+        FAST(greater_eq);
+        BINARY(flag(n1 >= n2));
+        NEXT();
+    CODE(equals)
+        NEEDS(2);
+        FAST(equals);
+        BINARY(flag(n1 == n2));
+        NEXT();
+    CODE(not_eq)
+        NEEDS(2);
+        FAST(not_eq);
+        BINARY(flag(n1 != n2));
+        NEXT();
+    CODE(and)
+        NEEDS(2);
+        FAST(and);
+        BINARY(n1 & n2);
+        NEXT();
+    CODE(or)
+        NEEDS(2);
+        FAST(or);
+        BINARY(n1 | n2);
+        NEXT();
+    CODE(xor)
+        NEEDS(2);
+        FAST(xor);
+        BINARY(n1 ^ n2);
+        NEXT();
+    CODE(zero_equals)
+        NEEDS(1);
+        FAST(zero_equals);
+        tos.num = flag(tos.num == 0);
+        NEXT();
+    CODE(nip)
+        NEEDS(2);
+        FAST(nip);
+        sp -= 1;
+        NEXT();
+    CODE(two_dup)
+        NEEDS(2);
+        ROOM(2);
+        FAST(two_dup);
+        *sp = tos;
+        sp[1] = sp[-1];
+        sp += 2;
+        NEXT();
+    CODE(lit_add)
+        NEEDS(1);
+        FAST(lit_add);
+        tos.num += OPERAND().num;
+        NEXT();
+    CODE(lit_sub)
+        NEEDS(1);
+        FAST(lit_sub);
+        tos.num -= OPERAND().num;
+        NEXT();
+    CODE(lit_less)
+        NEEDS(1);
+        FAST(lit_less);
+        tos.num = flag(tos.num < OPERAND().num);
+        NEXT();
+    CODE(lit_equals)
+        NEEDS(1);
+        FAST(lit_equals);
+        tos.num = flag(tos.num == OPERAND().num);
+        NEXT();
+    CODE(lit_fetch)
+        ROOM(1);
+        FAST(lit_fetch);
+        PUSH(*OPERAND().addr);
+        NEXT();
+    CODE(lit_store)
+        NEEDS(1);
+        FAST(lit_store);
+        *OPERAND().addr = tos;
+        tos = *--sp;
+        NEXT();
+    CODE(dup_fetch)
+        NEEDS(1);
+        ROOM(1);
+        FAST(dup_fetch);
+        PUSH(*tos.addr);
+        NEXT();
+    CODE(swap_store)
+        NEEDS(2);
+        FAST(swap_store);
+        *sp[-1].addr = tos;
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+    CODE(over_add)
+        NEEDS(2);
+        FAST(over_add);
+        tos.num += sp[-1].num;
+        NEXT();
+    CODE(dup_fetch_lit_add) {
+        NEEDS(1);
+        ROOM(1);
+        FAST(dup_fetch_lit_add);
+        Value n = *tos.addr;
+        n.num += OPERAND().num;
+        PUSH(n);
+        NEXT();
+    }
+    CODE(lit_add_store)
+        NEEDS(1);
+        FAST(lit_add_store);
+        tos.addr->num += OPERAND().num;
+        tos = *--sp;
+        NEXT();
+
+    // Timed versions of the operations above. Colon words are entered
+    // without counting calls for the JIT, so that nothing is compiled while
+    // profiling. Native words are timed by jit_call, as are their callees
+    prof_code:
+        profile_enter(&p->prof, w);
+        SAVE();
+        w->as.code(p);
+        LOAD();
+        profile_leave(&p->prof);
+        NEXT();
+    prof_colon:
+        profile_enter(&p->prof, w);
+        goto enter_colon;
+    prof_exit:
+        // The exit of the entry code only ends a word for primitives, which
+        // aren't timed
+        if(ip != entry + 2) profile_leave(&p->prof);
+        goto leave_colon;
+    prof_tail:
+        profile_leave(&p->prof);
+        goto tail_call;
+#if BKF_THREADED
+    trace:
+        TRACE();
+        goto *untraced[w->op];
+    // Calls and returns of words running unchecked, which go back to the
+    // plain table once the outermost one is left
+    fast_safe:
+        JIT_COUNT();
+        goto enter_colon;
+    fast_exit:
+        ip = (Code*)(rp--)->addr;
+        if(rp == rsafe) dispatch = plain;
+        RESET_PAIR();
+        NEXT();
+    fast_tail:
+        w = XT(*ip);
+        ip = (Code*)(rp--)->addr;
+        if(rp == rsafe) dispatch = plain;
+        DISPATCH();
+#endif // BKF_THREADED
+#if BKF_JIT
+    prof_jit:
+        SAVE();
+        jit_call(p, w);
+        LOAD();
+        NEXT();
+#endif // BKF_JIT
+
+#if !BKF_THREADED
+    default:
+        assert(false && "unknown operation");
+    }
+    }
+#endif // BKF_THREADED
+
+    // Errors unwind the stacks through the handler they're thrown to
+underflow:
+    SAVE();
+    error(p, THROW_stack_underflow, "stack underflow");
+overflow:
+    SAVE();
+    error(p, THROW_stack_overflow, "stack overflow");
+done:
+    SAVE();
+
+#undef CODE
+#undef FAST
+#undef JIT_COUNT
+#undef NEXT
+#undef DISPATCH
+#undef PROFILED
+#undef FETCH
+#undef XT
+#undef OPERAND
+#undef OFFSET
+#undef TRACE
+#undef COUNT_PAIR
+#undef RESET_PAIR
+#undef BINARY
+#undef LOAD
+#undef SAVE
+#undef PUSH
+#undef ROOM
+#undef NEEDS
+}
+
+#if BKF_JIT
+
+// The JIT translates the threaded code of a colon word to native code, for
+// x86-64 or AArch64, one operation at a time. The state of the inner
+// interpreter is kept in callee saved registers: the processor, the data
+// stack pointer, the top of the stack, the loop stack pointer and the base
+// of the data stack. Words that aren't primitives are called through C, with
+// the state saved to the processor
+
+// Places in the generated code other than the instructions of the body.
+// The errors are in the order of their messages in jit_errors
+enum {
+    JIT_RETURN = -1, // save the state and return
+    JIT_LEAVE = -2,  // return, with the result already in rax
+    JIT_UNDERFLOW = -3,
+    JIT_OVERFLOW = -4,
+    JIT_DIV_ZERO = -5,
+    JIT_LOOP_OVERFLOW = -6,
+    JIT_UNLOOP = -7,
+    JIT_LABELS = 7
+};
+
+static const char *const jit_errors[] = {
+    "stack underflow",
+    "stack overflow",
+    "division by zero",
+    "loop stack overflow",
+    "unloop outside of a loop",
+};
+
+static const int jit_throws[] = {
+    THROW_stack_underflow,
+    THROW_stack_overflow,
+    THROW_div_zero,
+    THROW_ls_overflow,
+    THROW_loop,
+};
+
+// Largest body, in cells, that the JIT translates
+#define JIT_MAX_CELLS 4096
+
+typedef struct {
+    size_t at;  // offset of the jump to patch
+    int target; // cell of the body, or one of the places above
+} JitFixup;
+
+typedef struct {
+    uint8_t *code;
+    size_t len, cap;
+    int *starts; // offset of the code of each instruction, by cell
+    int labels[JIT_LABELS];
+    JitFixup *fixups;
+    int fixup_count, fixup_cap;
+    bool unchecked; // the stack was checked on entry, for the whole word
+} Jit;
+
+void jit_byte(Jit *j, uint8_t b) {
+    if(j->len == j->cap) {
+        j->cap = j->cap == 0 ? 1024 : 2 * j->cap;
+        j->code = realloc_mem(j->code, j->cap);
+    }
+    j->code[j->len++] = b;
+}
+
+void jit_u32(Jit *j, uint32_t n) {
+    for(int i = 0; i < 4; ++i) jit_byte(j, n >> (8 * i));
+}
+
+void jit_u64(Jit *j, uint64_t n) {
+    for(int i = 0; i < 8; ++i) jit_byte(j, n >> (8 * i));
+}
+
+// Records a jump at the end of the code, to be patched once the code of
+// its target is known
+void jit_fixup(Jit *j, int target) {
+    if(j->fixup_count == j->fixup_cap) {
+        j->fixup_cap = j->fixup_cap == 0 ? 16 : 2 * j->fixup_cap;
+        j->fixups = realloc_mem(j->fixups, j->fixup_cap * sizeof(*j->fixups));
+    }
+    j->fixups[j->fixup_count++] = (JitFixup){ .at = j->len, .target = target };
+}
+
+void jit_place(Jit *j, int place) {
+    j->labels[-place - 1] = j->len;
+}
+
+_Noreturn void jit_error(Processor *p, int place) {
+    error(p, jit_throws[JIT_UNDERFLOW - place],
+            jit_errors[JIT_UNDERFLOW - place]);
+}
+
+// Calls a word from native code. Native words don't use the R stack, but
+// still take a cell of it, so it limits their nesting as well. The cell
+// holds the word, for forget to tell that it's running
+void jit_call(Processor *p, Word *w) {
+    while(w != NULL && w->op == OP_jit) {
+        if(p->rs.sp >= p->rs.limit)
+            error(p, THROW_rs_overflow, "return stack overflow");
+        (++p->rs.sp)->xt = w;
+        if(p->profiling) {
+            profile_enter(&p->prof, w);
+            w = w->native(p);
+            profile_leave(&p->prof);
+        } else w = w->native(p);
+        p->rs.sp -= 1;
+    }
+    if(w != NULL) execute_word(p, w);
+}
+
+void jit_execute(Processor *p) {
+    jit_call(p, proc_pop(p).xt);
+}
+
+// Length of the body of a colon word, in cells, up to the exit that ends
+// it, or -1 if it can't be translated
+int jit_body_len(Processor *p, Word *w) {
+    if(check_flag(w->flags, FLAG_raw)) return -1;
+    Value *limit = (Value*)p->here;
+    if(limit - w->as.body > JIT_MAX_CELLS) limit = w->as.body + JIT_MAX_CELLS;
+    return word_body_len(p, w, limit);
+}
+
+uint64_t value_bits(Value v) {
+    uint64_t bits = 0;
+    memcpy(&bits, &v, sizeof(v));
+    return bits;
+}
+
+#if defined(__x86_64__)
+
+// On x86-64, the processor is in rbx, the data stack pointer in r12, the top
+// of the stack in r13, the loop stack pointer in r14 and the base of the
+// data stack in r15
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// Condition codes, as encoded in jcc and setcc
+enum {
+    CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_NS = 0x9,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+void x64_rex(Jit *j, bool wide, int reg, int rm) {
+    uint8_t rex = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+    if(rex != 0x40) jit_byte(j, rex);
+}
+
+void x64_opcode(Jit *j, int opcode) {
+    if(opcode > 0xFF) jit_byte(j, opcode >> 8);
+    jit_byte(j, opcode & 0xFF);
+}
+
+// Instruction with a register operand in ModRM.rm. The reg operand is
+// either another register or an opcode extension
+void x64_rr(Jit *j, bool wide, int opcode, int reg, int rm) {
+    x64_rex(j, wide, reg, rm);
+    x64_opcode(j, opcode);
+    jit_byte(j, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// Instruction with a memory operand, at base + disp, in ModRM.rm
+void x64_rm(Jit *j, bool wide, int opcode, int reg, int base, int32_t disp) {
+    x64_rex(j, wide, reg, base);
+    x64_opcode(j, opcode);
+    int mod = disp == 0 && (base & 7) != RBP ? 0
+        : disp >= -128 && disp <= 127 ? 1 : 2;
+    jit_byte(j, mod << 6 | (reg & 7) << 3 | (base & 7));
+    if((base & 7) == RSP) jit_byte(j, 0x24);
+    if(mod == 1) jit_byte(j, disp);
+    else if(mod == 2) jit_u32(j, disp);
+}
+
+// Arithmetic with an immediate: ext is 0 for add, 5 for sub and 7 for cmp
+void x64_ri(Jit *j, bool wide, int ext, int rm, int32_t imm) {
+    if(imm >= -128 && imm <= 127) {
+        x64_rr(j, wide, 0x83, ext, rm);
+        jit_byte(j, imm);
+    } else {
+        x64_rr(j, wide, 0x81, ext, rm);
+        jit_u32(j, imm);
+    }
+}
+
+void x64_mov_imm(Jit *j, int reg, uint64_t imm) {
+    if(imm <= UINT32_MAX) {
+        x64_rex(j, false, 0, reg);
+        jit_byte(j, 0xB8 + (reg & 7));
+        jit_u32(j, imm);
+    } else {
+        x64_rex(j, true, 0, reg);
+        jit_byte(j, 0xB8 + (reg & 7));
+        jit_u64(j, imm);
+    }
+}
+
+void x64_push(Jit *j, int reg) {
+    x64_rex(j, false, 0, reg);
+    jit_byte(j, 0x50 + (reg & 7));
+}
+
+void x64_pop(Jit *j, int reg) {
+    x64_rex(j, false, 0, reg);
+    jit_byte(j, 0x58 + (reg & 7));
+}
+
+// Jumps to a cell of the body or a place, where cc < 0 means always
+void x64_jump(Jit *j, int cc, int target) {
+    x64_opcode(j, cc < 0 ? 0xE9 : 0x0F80 | cc);
+    jit_fixup(j, target);
+    jit_u32(j, 0);
+}
+
+void x64_call(Jit *j, uintptr_t fn) {
+    x64_mov_imm(j, RAX, fn);
+    x64_rr(j, false, 0xFF, 2, RAX);
+}
+
+// Sets tos to the flag for the condition, like flag() does
+void x64_flag(Jit *j, int cc) {
+    x64_rr(j, false, 0x0F90 | cc, 0, RAX);
+    x64_rr(j, false, 0x0FB6, RAX, RAX);
+    x64_rr(j, false, 0xF7, 3, RAX);
+    x64_rr(j, false, 0x89, RAX, R13);
+}
+
+void jit_save(Jit *j) {
+    x64_rm(j, true, 0x89, R13, R12, 0);
+    x64_rm(j, true, 0x89, R12, RBX, offsetof(Processor, ds.sp));
+    x64_rm(j, true, 0x89, R14, RBX, offsetof(Processor, ls.sp));
+}
+
+void jit_load(Jit *j) {
+    x64_rm(j, true, 0x8B, R12, RBX, offsetof(Processor, ds.sp));
+    x64_rm(j, true, 0x8B, R13, R12, 0);
+    x64_rm(j, true, 0x8B, R14, RBX, offsetof(Processor, ls.sp));
+    x64_rm(j, true, 0x8B, R15, RBX, offsetof(Processor, ds.base));
+}
+
+// Checks that the data stack has at least n cells
+void jit_needs(Jit *j, int n) {
+    if(j->unchecked) return;
+    if(n == 1) x64_rr(j, true, 0x39, R15, R12);
+    else {
+        x64_rm(j, true, 0x8D, RAX, R12, -8 * (n - 1));
+        x64_rr(j, true, 0x39, R15, RAX);
+    }
+    x64_jump(j, CC_B, JIT_UNDERFLOW);
+}
+
+// Checks that the data stack has room for n more cells
+void jit_room(Jit *j, int n) {
+    if(j->unchecked) return;
+    x64_rm(j, true, 0x8D, RAX, R12, 8 * n);
+    x64_rm(j, true, 0x3B, RAX, RBX, offsetof(Processor, ds.limit));
+    x64_jump(j, CC_A, JIT_OVERFLOW);
+}
+
+// Pushes tos down, making room for a new one
+void jit_push(Jit *j) {
+    x64_rm(j, true, 0x89, R13, R12, 0);
+    x64_ri(j, true, 0, R12, 8);
+}
+
+void jit_drop(Jit *j, int n) {
+    x64_ri(j, true, 5, R12, 8 * n);
+    x64_rm(j, true, 0x8B, R13, R12, 0);
+}
+
+// Operation on the two cells on top, with the result in tos
+void jit_binary(Jit *j, int opcode) {
+    jit_needs(j, 2);
+    x64_rm(j, false, 0x8B, RAX, R12, -8);
+    if(opcode == 0x0FAF) x64_rr(j, false, opcode, RAX, R13);
+    else x64_rr(j, false, opcode, R13, RAX);
+    x64_rr(j, false, 0x89, RAX, R13);
+    x64_ri(j, true, 5, R12, 8);
+}
+
+void jit_compare(Jit *j, int cc) {
+    jit_needs(j, 2);
+    x64_rm(j, false, 0x8B, RAX, R12, -8);
+    x64_rr(j, false, 0x39, R13, RAX);
+    x64_flag(j, cc);
+    x64_ri(j, true, 5, R12, 8);
+}
+
+// Calls a C function with the processor and, optionally, a word
+void jit_call_c(Jit *j, uintptr_t fn, Word *w) {
+    jit_save(j);
+    x64_rr(j, true, 0x89, RBX, RDI);
+    if(w != NULL) x64_mov_imm(j, RSI, (uintptr_t)w);
+    x64_call(j, fn);
+    jit_load(j);
+}
+
+bool jit_translate(Jit *j, Word *w, int len) {
+    Value *body = w->as.body;
+    for(int i = 0; i < len; i += 1 + op_operands[body[i].xt->op]) {
+        j->starts[i] = j->len;
+        Word *op = body[i].xt;
+        Value arg = body[i + 1];
+        int target = i + 1 + arg.num;
+        switch((Opcode)op->op) {
+        case OP_code:
+            jit_call_c(j, (uintptr_t)op->as.code, NULL);
+            break;
+        case OP_colon:
+        case OP_safe:
+        case OP_jit:
+            jit_call_c(j, (uintptr_t)jit_call, op);
+            break;
+        case OP_execute:
+            jit_call_c(j, (uintptr_t)jit_execute, NULL);
+            break;
+        case OP_exit:
+            x64_jump(j, -1, JIT_RETURN);
+            break;
+        case OP_push:
+            jit_room(j, 1);
+            jit_push(j);
+            x64_mov_imm(j, R13, value_bits(arg));
+            break;
+        case OP_tail:
+            // Tail recursion is a loop, other tail calls are made by the
+            // caller, so that they don't nest
+            if(arg.xt == w) x64_jump(j, -1, 0);
+            else {
+                jit_save(j);
+                x64_mov_imm(j, RAX, (uintptr_t)arg.xt);
+                x64_jump(j, -1, JIT_LEAVE);
+            }
+            break;
+        case OP_branch:
+            x64_jump(j, -1, target);
+            break;
+        case OP_zero_branch:
+            jit_needs(j, 1);
+            x64_rr(j, false, 0x89, R13, RAX);
+            jit_drop(j, 1);
+            x64_rr(j, false, 0x85, RAX, RAX);
+            x64_jump(j, CC_E, target);
+            break;
+        case OP_do:
+            jit_needs(j, 2);
+            x64_rm(j, true, 0x8D, RAX, R14, 16);
+            x64_rm(j, true, 0x3B, RAX, RBX, offsetof(Processor, ls.limit));
+            x64_jump(j, CC_A, JIT_LOOP_OVERFLOW);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            x64_rm(j, true, 0x89, RAX, R14, 8);
+            x64_rm(j, true, 0x89, R13, R14, 16);
+            x64_ri(j, true, 0, R14, 16);
+            jit_drop(j, 2);
+            break;
+        case OP_loop:
+            x64_rm(j, false, 0x8B, RAX, R14, 0);
+            x64_ri(j, false, 0, RAX, 1);
+            x64_rm(j, false, 0x89, RAX, R14, 0);
+            x64_rm(j, false, 0x3B, RAX, R14, -8);
+            x64_jump(j, CC_NE, target);
+            x64_ri(j, true, 5, R14, 16);
+            break;
+        case OP_plus_loop:
+            // Same as the inner interpreter, with the step in ecx and the
+            // distance of the index to the limit in edx
+            jit_needs(j, 1);
+            x64_rr(j, false, 0x89, R13, RCX);
+            jit_drop(j, 1);
+            x64_rm(j, false, 0x8B, RAX, R14, 0);
+            x64_rr(j, false, 0x89, RAX, RDX);
+            x64_rm(j, false, 0x2B, RDX, R14, -8);
+            x64_rr(j, false, 0x01, RCX, RAX);
+            x64_rm(j, false, 0x89, RAX, R14, 0);
+            x64_rr(j, false, 0x89, RDX, RAX);
+            x64_rr(j, false, 0x01, RCX, RAX);
+            x64_rr(j, false, 0x31, RDX, RAX);
+            x64_jump(j, CC_NS, target);
+            x64_rr(j, false, 0x89, RDX, RAX);
+            x64_rr(j, false, 0x31, RCX, RAX);
+            x64_jump(j, CC_NS, target);
+            x64_ri(j, true, 5, R14, 16);
+            break;
+        case OP_loop_i:
+        case OP_loop_j:
+            jit_room(j, 1);
+            jit_push(j);
+            x64_rm(j, true, 0x8B, R13, R14, op->op == OP_loop_i ? 0 : -16);
+            break;
+        case OP_unloop:
+            x64_rm(j, true, 0x3B, R14, RBX, offsetof(Processor, ls.base));
+            x64_jump(j, CC_B, JIT_UNLOOP);
+            x64_ri(j, true, 5, R14, 16);
+            break;
+        case OP_fetch:
+            jit_needs(j, 1);
+            x64_rm(j, true, 0x8B, R13, R13, 0);
+            break;
+        case OP_store:
+            jit_needs(j, 2);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            x64_rm(j, true, 0x89, RAX, R13, 0);
+            jit_drop(j, 2);
+            break;
+        case OP_index:
+            jit_needs(j, 2);
+            x64_rr(j, true, 0x63, RAX, R13);
+            x64_rr(j, true, 0xC1, 4, RAX);
+            jit_byte(j, 3);
+            x64_rm(j, true, 0x03, RAX, R12, -8);
+            x64_rr(j, true, 0x89, RAX, R13);
+            x64_ri(j, true, 5, R12, 8);
+            break;
+        case OP_dup:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            jit_push(j);
+            break;
+        case OP_drop:
+            jit_needs(j, 1);
+            jit_drop(j, 1);
+            break;
+        case OP_swap:
+            jit_needs(j, 2);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            x64_rm(j, true, 0x89, R13, R12, -8);
+            x64_rr(j, true, 0x89, RAX, R13);
+            break;
+        case OP_over:
+            jit_needs(j, 2);
+            jit_room(j, 1);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            jit_push(j);
+            x64_rr(j, true, 0x89, RAX, R13);
+            break;
+        case OP_rot:
+            jit_needs(j, 3);
+            x64_rm(j, true, 0x8B, RAX, R12, -16);
+            x64_rm(j, true, 0x8B, RCX, R12, -8);
+            x64_rm(j, true, 0x89, RCX, R12, -16);
+            x64_rm(j, true, 0x89, R13, R12, -8);
+            x64_rr(j, true, 0x89, RAX, R13);
+            break;
+        case OP_add:        jit_binary(j, 0x01);    break;
+        case OP_sub:        jit_binary(j, 0x29);    break;
+        case OP_mul:        jit_binary(j, 0x0FAF);  break;
+        case OP_and:        jit_binary(j, 0x21);    break;
+        case OP_or:         jit_binary(j, 0x09);    break;
+        case OP_xor:        jit_binary(j, 0x31);    break;
+        case OP_less:       jit_compare(j, CC_L);   break;
+        case OP_less_eq:    jit_compare(j, CC_LE);  break;
+        case OP_greater:    jit_compare(j, CC_G);   break;
+        case OP_greater_eq: jit_compare(j, CC_GE);  break;
+        case OP_equals:     jit_compare(j, CC_E);   break;
+        case OP_not_eq:     jit_compare(j, CC_NE);  break;
+        case OP_div:
+            jit_needs(j, 2);
+            x64_rr(j, false, 0x85, R13, R13);
+            x64_jump(j, CC_E, JIT_DIV_ZERO);
+            x64_rm(j, false, 0x8B, RAX, R12, -8);
+            // idiv faults on the one quotient that overflows, so dividing
+            // by -1 negates instead, which wraps around. The short jumps
+            // skip the 4 bytes of neg eax; jmp and of cdq; idiv r13d
+            x64_ri(j, false, 7, R13, -1);
+            jit_byte(j, 0x70 | CC_NE);
+            jit_byte(j, 4);
+            x64_rr(j, false, 0xF7, 3, RAX);
+            jit_byte(j, 0xEB);
+            jit_byte(j, 4);
+            jit_byte(j, 0x99);
+            x64_rr(j, false, 0xF7, 7, R13);
+            x64_rr(j, false, 0x89, RAX, R13);
+            x64_ri(j, true, 5, R12, 8);
+            break;
+        case OP_zero_equals:
+            jit_needs(j, 1);
+            x64_rr(j, false, 0x85, R13, R13);
+            x64_flag(j, CC_E);
+            break;
+        case OP_nip:
+            jit_needs(j, 2);
+            x64_ri(j, true, 5, R12, 8);
+            break;
+        case OP_two_dup:
+            jit_needs(j, 2);
+            jit_room(j, 2);
+            x64_rm(j, true, 0x89, R13, R12, 0);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            x64_rm(j, true, 0x89, RAX, R12, 8);
+            x64_ri(j, true, 0, R12, 16);
+            break;
+        case OP_lit_add:
+        case OP_lit_sub:
+            jit_needs(j, 1);
+            x64_ri(j, false, op->op == OP_lit_add ? 0 : 5, R13, arg.num);
+            break;
+        case OP_lit_less:
+        case OP_lit_equals:
+            jit_needs(j, 1);
+            x64_ri(j, false, 7, R13, arg.num);
+            x64_flag(j, op->op == OP_lit_less ? CC_L : CC_E);
+            break;
+        case OP_lit_fetch:
+            jit_room(j, 1);
+            jit_push(j);
+            x64_mov_imm(j, RAX, (uintptr_t)arg.addr);
+            x64_rm(j, true, 0x8B, R13, RAX, 0);
+            break;
+        case OP_lit_store:
+            jit_needs(j, 1);
+            x64_mov_imm(j, RAX, (uintptr_t)arg.addr);
+            x64_rm(j, true, 0x89, R13, RAX, 0);
+            jit_drop(j, 1);
+            break;
+        case OP_dup_fetch:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            jit_push(j);
+            x64_rm(j, true, 0x8B, R13, R13, 0);
+            break;
+        case OP_swap_store:
+            jit_needs(j, 2);
+            x64_rm(j, true, 0x8B, RAX, R12, -8);
+            x64_rm(j, true, 0x89, R13, RAX, 0);
+            jit_drop(j, 2);
+            break;
+        case OP_over_add:
+            jit_needs(j, 2);
+            x64_rm(j, false, 0x03, R13, R12, -8);
+            break;
+        case OP_dup_fetch_lit_add:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            x64_rm(j, true, 0x8B, RAX, R13, 0);
+            x64_ri(j, false, 0, RAX, arg.num);
+            jit_push(j);
+            x64_rr(j, true, 0x89, RAX, R13);
+            break;
+        case OP_lit_add_store:
+            jit_needs(j, 1);
+            x64_rm(j, false, 0x81, 0, R13, 0);
+            jit_u32(j, arg.num);
+            jit_drop(j, 1);
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+void jit_prologue(Jit *j) {
+    x64_push(j, RBX);
+    x64_push(j, R12);
+    x64_push(j, R13);
+    x64_push(j, R14);
+    x64_push(j, R15);
+    x64_rr(j, true, 0x89, RDI, RBX);
+    jit_load(j);
+}
+
+void jit_epilogue(Jit *j) {
+    jit_place(j, JIT_RETURN);
+    jit_save(j);
+    x64_rr(j, false, 0x31, RAX, RAX);
+    jit_place(j, JIT_LEAVE);
+    x64_pop(j, R15);
+    x64_pop(j, R14);
+    x64_pop(j, R13);
+    x64_pop(j, R12);
+    x64_pop(j, RBX);
+    jit_byte(j, 0xC3);
+    for(int place = JIT_UNDERFLOW; place >= JIT_UNLOOP; --place) {
+        jit_place(j, place);
+        jit_save(j);
+        x64_rr(j, true, 0x89, RBX, RDI);
+        x64_mov_imm(j, RSI, (uint32_t)place);
+        // Errors are thrown, so the call doesn't return
+        x64_call(j, (uintptr_t)jit_error);
+    }
+}
+
+// Points a jump at its target, relative to the end of the rel32
+void jit_patch(Jit *j, JitFixup *f, int to) {
+    uint32_t rel = to - (int)(f->at + 4);
+    memcpy(j->code + f->at, &rel, sizeof(rel));
+}
+
+#elif defined(__aarch64__)
+
+// On AArch64, the processor is in x19, the data stack pointer in x20, the
+// top of the stack in x21, the loop stack pointer in x22 and the base of the
+// data stack in x23. x16 holds the functions called and x17 the immediates
+// that don't fit in an instruction. Register 31 is the zero register or sp,
+// depending on the instruction
+enum {
+    X0 = 0, X1 = 1, X2 = 2, X16 = 16, X17 = 17, X19 = 19, X20 = 20,
+    X21 = 21, X22 = 22, X23 = 23, X24 = 24, ZR = 31
+};
+
+// Condition codes, as encoded in b.cond and csel
+enum {
+    CC_EQ = 0x0, CC_NE = 0x1, CC_LO = 0x3, CC_PL = 0x5, CC_HI = 0x8,
+    CC_GE = 0xA, CC_LT = 0xB, CC_GT = 0xC, CC_LE = 0xD
+};
+
+// Instructions on registers, with the registers and the size bit all 0
+enum {
+    A64_ADD = 0x0B000000, A64_SUB = 0x4B000000, A64_SUBS = 0x6B000000,
+    A64_AND = 0x0A000000, A64_ANDS = 0x6A000000, A64_ORR = 0x2A000000,
+    A64_EOR = 0x4A000000, A64_MUL = 0x1B007C00, A64_SDIV = 0x1AC00C00
+};
+
+void a64(Jit *j, uint32_t ins) {
+    jit_u32(j, ins);
 }
 
-void w_less_eq(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num <= n2.num));
+// rd = rn op rm, on 64 bits if wide and 32 if not
+void a64_rrr(Jit *j, bool wide, uint32_t op, int rd, int rn, int rm) {
+    a64(j, (uint32_t)wide << 31 | op | rm << 16 | rn << 5 | rd);
 }
 
-void w_greater(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num > n2.num));
+void a64_mov(Jit *j, bool wide, int rd, int rm) {
+    a64_rrr(j, wide, A64_ORR, rd, ZR, rm);
 }
 
-void w_greater_eq(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num >= n2.num));
+void a64_cmp(Jit *j, bool wide, int rn, int rm) {
+    a64_rrr(j, wide, A64_SUBS, ZR, rn, rm);
 }
 
-void w_equals(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num == n2.num));
+// Loads an immediate 16 bits at a time, with movz and then movk
+void a64_mov_imm(Jit *j, int rd, uint64_t imm) {
+    a64(j, 0xD2800000 | (uint32_t)(imm & 0xFFFF) << 5 | rd);
+    for(int hw = 1; hw < 4; ++hw) {
+        uint32_t part = imm >> (16 * hw) & 0xFFFF;
+        if(part != 0) a64(j, 0xF2800000 | hw << 21 | part << 5 | rd);
+    }
+}
+
+// Arithmetic with an immediate: op is A64_ADD, A64_SUB or A64_SUBS, which
+// swap between adding and subtracting for small negative immediates. Others
+// that don't fit in 12 bits go through x17
+void a64_ri(Jit *j, bool wide, uint32_t op, int rd, int rn, int32_t imm) {
+    if(imm < 0 && imm > -4096) {
+        op ^= A64_ADD ^ A64_SUB;
+        imm = -imm;
+    }
+    if(imm >= 0 && imm < 4096) {
+        a64(j, (uint32_t)wide << 31 | (op + 0x06000000) | imm << 10
+                | rn << 5 | rd);
+    } else {
+        a64_mov_imm(j, X17, wide ? (uint64_t)(int64_t)imm : (uint32_t)imm);
+        a64_rrr(j, wide, op, rd, rn, X17);
+    }
+}
+
+// Load or store of 64 or 32 bits at base + disp, with a scaled unsigned
+// offset if it fits, and an unscaled signed one if not
+void a64_mem(Jit *j, bool wide, bool load, int rt, int rn, int32_t disp) {
+    int size = wide ? 8 : 4;
+    uint32_t ins = (wide ? 0xF8000000 : 0xB8000000) | (uint32_t)load << 22;
+    if(disp >= 0 && disp % size == 0 && disp / size < 4096)
+        a64(j, ins | 0x01000000 | (disp / size) << 10 | rn << 5 | rt);
+    else if(disp >= -256 && disp < 256)
+        a64(j, ins | (disp & 0x1FF) << 12 | rn << 5 | rt);
+    else {
+        a64_mov_imm(j, X17, (uint64_t)(int64_t)disp);
+        a64_rrr(j, true, A64_ADD, X17, rn, X17);
+        a64(j, ins | 0x01000000 | X17 << 5 | rt);
+    }
+}
+
+void a64_ldr(Jit *j, bool wide, int rt, int rn, int32_t disp) {
+    a64_mem(j, wide, true, rt, rn, disp);
+}
+
+void a64_str(Jit *j, bool wide, int rt, int rn, int32_t disp) {
+    a64_mem(j, wide, false, rt, rn, disp);
+}
+
+// Load or store of a pair of registers at sp + disp
+void a64_pair(Jit *j, bool load, int rt, int rt2, int disp) {
+    a64(j, 0xA9000000 | (uint32_t)load << 22 | (disp / 8) << 15 | rt2 << 10
+            | 31 << 5 | rt);
+}
+
+// Jumps to a cell of the body or a place, where cc < 0 means always
+void a64_jump(Jit *j, int cc, int target) {
+    jit_fixup(j, target);
+    a64(j, cc < 0 ? 0x14000000 : 0x54000000 | cc);
 }
 
-void w_not_eq(Processor *p) {
-    Value n2 = proc_pop(p);
-    Value n1 = proc_pop(p);
-    ds_push_num(&p->ds, flag(n1.num != n2.num));
+// Jumps if the low 32 bits of a register are 0
+void a64_cbz(Jit *j, int rt, int target) {
+    jit_fixup(j, target);
+    a64(j, 0x34000000 | rt);
 }
 
-void w_and(Processor *p) {
-    Value f2 = proc_pop(p);
-    Value f1 = proc_pop(p);
-    ds_push_num(&p->ds, f1.num & f2.num);
+void a64_call(Jit *j, uintptr_t fn) {
+    a64_mov_imm(j, X16, fn);
+    a64(j, 0xD63F0000 | X16 << 5);
 }
 
-void w_or(Processor *p) {
-    Value f2 = proc_pop(p);
-    Value f1 = proc_pop(p);
-    ds_push_num(&p->ds, f1.num | f2.num);
+// Sets tos to the flag for the condition, like flag() does, with csetm
+void a64_flag(Jit *j, int cc) {
+    a64(j, 0x5A9F03E0 | (cc ^ 1) << 12 | X21);
 }
 
-void w_xor(Processor *p) {
-    Value f2 = proc_pop(p);
-    Value f1 = proc_pop(p);
-    ds_push_num(&p->ds, f1.num ^ f2.num);
+void jit_save(Jit *j) {
+    a64_str(j, true, X21, X20, 0);
+    a64_str(j, true, X20, X19, offsetof(Processor, ds.sp));
+    a64_str(j, true, X22, X19, offsetof(Processor, ls.sp));
+}
+
+void jit_load(Jit *j) {
+    a64_ldr(j, true, X20, X19, offsetof(Processor, ds.sp));
+    a64_ldr(j, true, X21, X20, 0);
+    a64_ldr(j, true, X22, X19, offsetof(Processor, ls.sp));
+    a64_ldr(j, true, X23, X19, offsetof(Processor, ds.base));
+}
+
+// Checks that the data stack has at least n cells
+void jit_needs(Jit *j, int n) {
+    if(j->unchecked) return;
+    if(n == 1) a64_cmp(j, true, X20, X23);
+    else {
+        a64_ri(j, true, A64_SUB, X0, X20, 8 * (n - 1));
+        a64_cmp(j, true, X0, X23);
+    }
+    a64_jump(j, CC_LO, JIT_UNDERFLOW);
+}
+
+// Checks that the data stack has room for n more cells
+void jit_room(Jit *j, int n) {
+    if(j->unchecked) return;
+    a64_ri(j, true, A64_ADD, X0, X20, 8 * n);
+    a64_ldr(j, true, X1, X19, offsetof(Processor, ds.limit));
+    a64_cmp(j, true, X0, X1);
+    a64_jump(j, CC_HI, JIT_OVERFLOW);
+}
+
+// Pushes tos down, making room for a new one
+void jit_push(Jit *j) {
+    a64_str(j, true, X21, X20, 0);
+    a64_ri(j, true, A64_ADD, X20, X20, 8);
+}
+
+void jit_drop(Jit *j, int n) {
+    a64_ri(j, true, A64_SUB, X20, X20, 8 * n);
+    a64_ldr(j, true, X21, X20, 0);
+}
+
+// Operation on the two cells on top, with the result in tos
+void jit_binary(Jit *j, uint32_t op) {
+    jit_needs(j, 2);
+    a64_ldr(j, false, X0, X20, -8);
+    a64_rrr(j, false, op, X21, X0, X21);
+    a64_ri(j, true, A64_SUB, X20, X20, 8);
+}
+
+void jit_compare(Jit *j, int cc) {
+    jit_needs(j, 2);
+    a64_ldr(j, false, X0, X20, -8);
+    a64_cmp(j, false, X0, X21);
+    a64_flag(j, cc);
+    a64_ri(j, true, A64_SUB, X20, X20, 8);
+}
+
+// Calls a C function with the processor and, optionally, a word
+void jit_call_c(Jit *j, uintptr_t fn, Word *w) {
+    jit_save(j);
+    a64_mov(j, true, X0, X19);
+    if(w != NULL) a64_mov_imm(j, X1, (uintptr_t)w);
+    a64_call(j, fn);
+    jit_load(j);
+}
+
+bool jit_translate(Jit *j, Word *w, int len) {
+    Value *body = w->as.body;
+    for(int i = 0; i < len; i += 1 + op_operands[body[i].xt->op]) {
+        j->starts[i] = j->len;
+        Word *op = body[i].xt;
+        Value arg = body[i + 1];
+        int target = i + 1 + arg.num;
+        switch((Opcode)op->op) {
+        case OP_code:
+            jit_call_c(j, (uintptr_t)op->as.code, NULL);
+            break;
+        case OP_colon:
+        case OP_safe:
+        case OP_jit:
+            jit_call_c(j, (uintptr_t)jit_call, op);
+            break;
+        case OP_execute:
+            jit_call_c(j, (uintptr_t)jit_execute, NULL);
+            break;
+        case OP_exit:
+            a64_jump(j, -1, JIT_RETURN);
+            break;
+        case OP_push:
+            jit_room(j, 1);
+            jit_push(j);
+            a64_mov_imm(j, X21, value_bits(arg));
+            break;
+        case OP_tail:
+            // Tail recursion is a loop, other tail calls are made by the
+            // caller, so that they don't nest
+            if(arg.xt == w) a64_jump(j, -1, 0);
+            else {
+                jit_save(j);
+                a64_mov_imm(j, X0, (uintptr_t)arg.xt);
+                a64_jump(j, -1, JIT_LEAVE);
+            }
+            break;
+        case OP_branch:
+            a64_jump(j, -1, target);
+            break;
+        case OP_zero_branch:
+            jit_needs(j, 1);
+            a64_mov(j, false, X0, X21);
+            jit_drop(j, 1);
+            a64_cbz(j, X0, target);
+            break;
+        case OP_do:
+            jit_needs(j, 2);
+            a64_ri(j, true, A64_ADD, X0, X22, 16);
+            a64_ldr(j, true, X1, X19, offsetof(Processor, ls.limit));
+            a64_cmp(j, true, X0, X1);
+            a64_jump(j, CC_HI, JIT_LOOP_OVERFLOW);
+            a64_ldr(j, true, X0, X20, -8);
+            a64_str(j, true, X0, X22, 8);
+            a64_str(j, true, X21, X22, 16);
+            a64_ri(j, true, A64_ADD, X22, X22, 16);
+            jit_drop(j, 2);
+            break;
+        case OP_loop:
+            a64_ldr(j, false, X0, X22, 0);
+            a64_ri(j, false, A64_ADD, X0, X0, 1);
+            a64_str(j, false, X0, X22, 0);
+            a64_ldr(j, false, X1, X22, -8);
+            a64_cmp(j, false, X0, X1);
+            a64_jump(j, CC_NE, target);
+            a64_ri(j, true, A64_SUB, X22, X22, 16);
+            break;
+        case OP_plus_loop:
+            // Same as the inner interpreter, with the step in w1 and the
+            // distance of the index to the limit in w2
+            jit_needs(j, 1);
+            a64_mov(j, false, X1, X21);
+            jit_drop(j, 1);
+            a64_ldr(j, false, X0, X22, 0);
+            a64_ldr(j, false, X2, X22, -8);
+            a64_rrr(j, false, A64_SUB, X2, X0, X2);
+            a64_rrr(j, false, A64_ADD, X0, X0, X1);
+            a64_str(j, false, X0, X22, 0);
+            a64_rrr(j, false, A64_ADD, X0, X2, X1);
+            a64_rrr(j, false, A64_EOR, X0, X0, X2);
+            a64_rrr(j, false, A64_ANDS, ZR, X0, X0);
+            a64_jump(j, CC_PL, target);
+            a64_rrr(j, false, A64_EOR, X0, X2, X1);
+            a64_rrr(j, false, A64_ANDS, ZR, X0, X0);
+            a64_jump(j, CC_PL, target);
+            a64_ri(j, true, A64_SUB, X22, X22, 16);
+            break;
+        case OP_loop_i:
+        case OP_loop_j:
+            jit_room(j, 1);
+            jit_push(j);
+            a64_ldr(j, true, X21, X22, op->op == OP_loop_i ? 0 : -16);
+            break;
+        case OP_unloop:
+            a64_ldr(j, true, X0, X19, offsetof(Processor, ls.base));
+            a64_cmp(j, true, X22, X0);
+            a64_jump(j, CC_LO, JIT_UNLOOP);
+            a64_ri(j, true, A64_SUB, X22, X22, 16);
+            break;
+        case OP_fetch:
+            jit_needs(j, 1);
+            a64_ldr(j, true, X21, X21, 0);
+            break;
+        case OP_store:
+            jit_needs(j, 2);
+            a64_ldr(j, true, X0, X20, -8);
+            a64_str(j, true, X0, X21, 0);
+            jit_drop(j, 2);
+            break;
+        case OP_index:
+            jit_needs(j, 2);
+            a64_ldr(j, true, X0, X20, -8);
+            // add x21, x0, w21, sxtw #3
+            a64(j, 0x8B20CC00 | X21 << 16 | X0 << 5 | X21);
+            a64_ri(j, true, A64_SUB, X20, X20, 8);
+            break;
+        case OP_dup:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            jit_push(j);
+            break;
+        case OP_drop:
+            jit_needs(j, 1);
+            jit_drop(j, 1);
+            break;
+        case OP_swap:
+            jit_needs(j, 2);
+            a64_ldr(j, true, X0, X20, -8);
+            a64_str(j, true, X21, X20, -8);
+            a64_mov(j, true, X21, X0);
+            break;
+        case OP_over:
+            jit_needs(j, 2);
+            jit_room(j, 1);
+            a64_ldr(j, true, X0, X20, -8);
+            jit_push(j);
+            a64_mov(j, true, X21, X0);
+            break;
+        case OP_rot:
+            jit_needs(j, 3);
+            a64_ldr(j, true, X0, X20, -16);
+            a64_ldr(j, true, X1, X20, -8);
+            a64_str(j, true, X1, X20, -16);
+            a64_str(j, true, X21, X20, -8);
+            a64_mov(j, true, X21, X0);
+            break;
+        case OP_add:        jit_binary(j, A64_ADD); break;
+        case OP_sub:        jit_binary(j, A64_SUB); break;
+        case OP_mul:        jit_binary(j, A64_MUL); break;
+        case OP_and:        jit_binary(j, A64_AND); break;
+        case OP_or:         jit_binary(j, A64_ORR); break;
+        case OP_xor:        jit_binary(j, A64_EOR); break;
+        case OP_less:       jit_compare(j, CC_LT);  break;
+        case OP_less_eq:    jit_compare(j, CC_LE);  break;
+        case OP_greater:    jit_compare(j, CC_GT);  break;
+        case OP_greater_eq: jit_compare(j, CC_GE);  break;
+        case OP_equals:     jit_compare(j, CC_EQ);  break;
+        case OP_not_eq:     jit_compare(j, CC_NE);  break;
+        case OP_div:
+            // sdiv doesn't trap, and the one quotient that overflows wraps
+            // around, like in the interpreter, so only 0 is checked
+            jit_needs(j, 2);
+            a64_cbz(j, X21, JIT_DIV_ZERO);
+            a64_ldr(j, false, X0, X20, -8);
+            a64_rrr(j, false, A64_SDIV, X21, X0, X21);
+            a64_ri(j, true, A64_SUB, X20, X20, 8);
+            break;
+        case OP_zero_equals:
+            jit_needs(j, 1);
+            a64_ri(j, false, A64_SUBS, ZR, X21, 0);
+            a64_flag(j, CC_EQ);
+            break;
+        case OP_nip:
+            jit_needs(j, 2);
+            a64_ri(j, true, A64_SUB, X20, X20, 8);
+            break;
+        case OP_two_dup:
+            jit_needs(j, 2);
+            jit_room(j, 2);
+            a64_str(j, true, X21, X20, 0);
+            a64_ldr(j, true, X0, X20, -8);
+            a64_str(j, true, X0, X20, 8);
+            a64_ri(j, true, A64_ADD, X20, X20, 16);
+            break;
+        case OP_lit_add:
+        case OP_lit_sub:
+            jit_needs(j, 1);
+            a64_ri(j, false, op->op == OP_lit_add ? A64_ADD : A64_SUB,
+                    X21, X21, arg.num);
+            break;
+        case OP_lit_less:
+        case OP_lit_equals:
+            jit_needs(j, 1);
+            a64_ri(j, false, A64_SUBS, ZR, X21, arg.num);
+            a64_flag(j, op->op == OP_lit_less ? CC_LT : CC_EQ);
+            break;
+        case OP_lit_fetch:
+            jit_room(j, 1);
+            jit_push(j);
+            a64_mov_imm(j, X0, (uintptr_t)arg.addr);
+            a64_ldr(j, true, X21, X0, 0);
+            break;
+        case OP_lit_store:
+            jit_needs(j, 1);
+            a64_mov_imm(j, X0, (uintptr_t)arg.addr);
+            a64_str(j, true, X21, X0, 0);
+            jit_drop(j, 1);
+            break;
+        case OP_dup_fetch:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            jit_push(j);
+            a64_ldr(j, true, X21, X21, 0);
+            break;
+        case OP_swap_store:
+            jit_needs(j, 2);
+            a64_ldr(j, true, X0, X20, -8);
+            a64_str(j, true, X21, X0, 0);
+            jit_drop(j, 2);
+            break;
+        case OP_over_add:
+            jit_needs(j, 2);
+            a64_ldr(j, false, X0, X20, -8);
+            a64_rrr(j, false, A64_ADD, X21, X21, X0);
+            break;
+        case OP_dup_fetch_lit_add:
+            jit_needs(j, 1);
+            jit_room(j, 1);
+            a64_ldr(j, true, X0, X21, 0);
+            a64_ri(j, false, A64_ADD, X0, X0, arg.num);
+            jit_push(j);
+            a64_mov(j, true, X21, X0);
+            break;
+        case OP_lit_add_store:
+            jit_needs(j, 1);
+            a64_ldr(j, false, X0, X21, 0);
+            a64_ri(j, false, A64_ADD, X0, X0, arg.num);
+            a64_str(j, false, X0, X21, 0);
+            jit_drop(j, 1);
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// Takes the processor in x0, and keeps the registers it uses in a frame of
+// 64 bytes, along with the frame pointer and the link register
+void jit_prologue(Jit *j) {
+    a64(j, 0xA9BC7BFD); // stp x29, x30, [sp, #-64]!
+    a64(j, 0x910003FD); // mov x29, sp
+    a64_pair(j, false, X19, X20, 16);
+    a64_pair(j, false, X21, X22, 32);
+    a64_pair(j, false, X23, X24, 48);
+    a64_mov(j, true, X19, X0);
+    jit_load(j);
+}
+
+void jit_epilogue(Jit *j) {
+    jit_place(j, JIT_RETURN);
+    jit_save(j);
+    a64_mov(j, true, X0, ZR);
+    jit_place(j, JIT_LEAVE);
+    a64_pair(j, true, X19, X20, 16);
+    a64_pair(j, true, X21, X22, 32);
+    a64_pair(j, true, X23, X24, 48);
+    a64(j, 0xA8C47BFD); // ldp x29, x30, [sp], #64
+    a64(j, 0xD65F03C0); // ret
+    for(int place = JIT_UNDERFLOW; place >= JIT_UNLOOP; --place) {
+        jit_place(j, place);
+        jit_save(j);
+        a64_mov(j, true, X0, X19);
+        a64_mov_imm(j, X1, (uint32_t)place);
+        // Errors are thrown, so the call doesn't return
+        a64_call(j, (uintptr_t)jit_error);
+    }
+}
+
+// Points a jump at its target, in words: b has 26 bits for it, and b.cond
+// and cbz have 19, above the condition or the register
+void jit_patch(Jit *j, JitFixup *f, int to) {
+    uint8_t *at = j->code + f->at;
+    uint32_t ins = at[0] | at[1] << 8 | at[2] << 16 | (uint32_t)at[3] << 24;
+    uint32_t rel = (uint32_t)((to - (int)f->at) / 4);
+    if((ins & 0xFC000000) == 0x14000000) ins |= rel & 0x3FFFFFF;
+    else ins |= (rel & 0x7FFFF) << 5;
+    for(int i = 0; i < 4; ++i) at[i] = ins >> (8 * i);
+}
+
+#endif // __x86_64__
+
+// Compiles a colon word to native code and installs it, so that from then
+// on it runs as OP_jit. Words that can't be compiled are left as they are
+bool jit_compile(Processor *p, Word *w) {
+    int len = jit_body_len(p, w);
+    if(len < 0) return false;
+    Jit j = { 0 };
+    j.starts = get_mem(len * sizeof(*j.starts));
+    for(int i = 0; i < len; ++i) j.starts[i] = -1;
+
+    jit_prologue(&j);
+    // Like in the interpreter, words with a known effect check the stack
+    // only once
+    if(w->effect.in >= 0) {
+        if(w->effect.in > 0) jit_needs(&j, w->effect.in);
+        if(w->effect.grow > 0) jit_room(&j, w->effect.grow);
+        j.unchecked = true;
+    }
+    bool ok = jit_translate(&j, w, len);
+    jit_epilogue(&j);
+
+    for(int i = 0; ok && i < j.fixup_count; ++i) {
+        JitFixup *f = &j.fixups[i];
+        int to = f->target < 0 ? j.labels[-f->target - 1]
+            : f->target < len ? j.starts[f->target] : -1;
+        if(to < 0) ok = false;
+        else jit_patch(&j, f, to);
+    }
+
+    // The code is copied to memory of its own, which is then made
+    // executable and never writable again
+    void *mem = MAP_FAILED;
+    size_t size = (j.len + page_size() - 1) / page_size() * page_size();
+    if(ok) mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem != MAP_FAILED) {
+        memcpy(mem, j.code, j.len);
+        // AArch64 doesn't fetch instructions through the data cache, so the
+        // copy has to be flushed before it runs
+        __builtin___clear_cache((char*)mem, (char*)mem + j.len);
+        if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, size);
+            mem = MAP_FAILED;
+        }
+    }
+    free_mem(j.code);
+    free_mem(j.starts);
+    free_mem(j.fixups);
+    if(mem == MAP_FAILED) return false;
+
+    if(p->jit_count == p->jit_cap) {
+        p->jit_cap = p->jit_cap == 0 ? 16 : 2 * p->jit_cap;
+        p->jit_blocks = realloc_mem(p->jit_blocks,
+                p->jit_cap * sizeof(*p->jit_blocks));
+    }
+    p->jit_blocks[p->jit_count++] = (JitBlock){ .code = mem, .size = size };
+    w->native = (JitFn)(uintptr_t)mem;
+    w->op = OP_jit;
+    return true;
+}
+
+#endif // BKF_JIT
+
+// -----------------------------------------------------------------------------
+
+// Fuses the instruction at first with the one following it, at second,
+// if there is a rule for them. The second one must be the last in the body
+bool proc_fuse(Processor *p, Code *first, Code *second) {
+    Instr in1 = code_decode(p, first), in2 = code_decode(p, second);
+    Opcode op1 = in1.xt->op, op2 = in2.xt->op;
+    for(int i = 0; i < FUSION_COUNT; ++i) {
+        const Fusion *f = &fusions[i];
+        if(f->first != op1 || f->second != op2) continue;
+        if(f->zero && in1.arg.num != 0) continue;
+        int n1 = f->zero ? 0 : in1.len - 1, n2 = in2.len - 1;
+        *first = code_cell(p->prims[f->fused]);
+        memmove(first + 1 + n1, second + 1, n2 * sizeof(Code));
+        p->here = (uint8_t*)(first + 1 + n1 + n2);
+        p->fusion_hits[i] += 1;
+        return true;
+    }
+    return false;
+}
+
+// Works out a pure operation at compile time, on literals: top is the last
+// one, with the one before it below, and arg is the operand of the
+// operation. The result is top with its number replaced, as in the inner
+// interpreter. Returns false if the operation isn't pure, or would fail
+bool op_fold(Opcode op, const Value *top, Value arg, Value *result) {
+    i32 n1 = top[-1].num, n2 = top[0].num;
+    uint32_t u1 = n1, u2 = n2;
+    *result = top[0];
+    switch(op) {
+    // Overflow wraps around, like it does on the machines the inner
+    // interpreter runs on
+    case OP_add:        result->num = (i32)(u1 + u2); break;
+    case OP_sub:        result->num = (i32)(u1 - u2); break;
+    case OP_mul:        result->num = (i32)(u1 * u2); break;
+    case OP_div:
+        if(n2 == 0) return false;
+        result->num = n2 == -1 ? (i32)(0u - u1) : n1 / n2;
+        break;
+    case OP_less:       result->num = flag(n1 < n2); break;
+    case OP_less_eq:    result->num = flag(n1 <= n2); break;
+    case OP_greater:    result->num = flag(n1 > n2); break;
+    case OP_greater_eq: result->num = flag(n1 >= n2); break;
+    case OP_equals:     result->num = flag(n1 == n2); break;
+    case OP_not_eq:     result->num = flag(n1 != n2); break;
+    case OP_and:        result->num = n1 & n2; break;
+    case OP_or:         result->num = n1 | n2; break;
+    case OP_xor:        result->num = n1 ^ n2; break;
+    case OP_zero_equals: result->num = flag(n2 == 0); break;
+    case OP_lit_add:    result->num = (i32)(u2 + (uint32_t)arg.num); break;
+    case OP_lit_sub:    result->num = (i32)(u2 - (uint32_t)arg.num); break;
+    case OP_lit_less:   result->num = flag(n2 < arg.num); break;
+    case OP_lit_equals: result->num = flag(n2 == arg.num); break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Folds a pure operation on the literals compiled last, by taking them back
+// to compile a literal with its result in their place, which may go on to be
+// folded in turn. Returns whether it could
+bool proc_fold(Processor *p, Word *w, const Value *operands, Value *result) {
+    int in = w->effect.in, count = p->comp_lit_count;
+    if(in < 1 || in > 2 || count < in) return false;
+    // Each literal but the last one is the instruction before the next
+    Value lits[2] = { { .num = 0 }, { .num = 0 } };
+    Code *first = NULL;
+    for(int i = 0; i < in; ++i) {
+        int k = count - in + i;
+        Code *lit = k + 1 < count ? p->comp_lits[k + 1] : p->comp_last;
+        if(i == 0) first = lit;
+        lits[2 - in + i] = code_decode(p, lit).arg;
+    }
+    Value arg = op_operands[w->op] > 0 ? operands[0] : (Value){ .num = 0 };
+    if(!op_fold(w->op, &lits[1], arg, result)) return false;
+
+    int k = count - in;
+    p->here = (uint8_t*)first;
+    p->comp_last = p->comp_lits[k];
+    p->comp_prev = k > 0 ? p->comp_lits[k - 1] : NULL;
+    p->comp_lit_count = k;
+    return true;
+}
+
+// Compiles an instruction, with its operands, into the current definition
+void proc_compile_op(Processor *p, Word *w, const Value *operands) {
+    Value folded;
+    if(proc_fold(p, w, operands, &folded)) {
+        w = p->w_push;
+        operands = &folded;
+    }
+    // What follows activate runs in a task, as if the word ended there,
+    // and without the frame of the locals
+    if(w == p->w_exit || w->op == OP_activate) p->comp_straight = false;
+    if(w->op == OP_activate && p->local_count > 0)
+        error(p, THROW_control, "can't activate a task in a word with locals");
+    // Exits drop the frame of the locals on the way out
+    Value cells = { .num = p->local_count };
+    if(w == p->w_exit && p->local_count > 0) {
+        w = p->prims[OP_leave];
+        operands = &cells;
+    }
+    Code *before = p->comp_last;
+    Code *instr = proc_comma_code(p, code_cell(w));
+    for(int i = 0; i < op_operands[w->op]; ++i)
+        proc_comma_operand(p, w->op, operands[i]);
+
+    if(p->comp_last == NULL || !proc_fuse(p, p->comp_last, instr)) {
+        p->comp_prev = p->comp_last;
+        p->comp_last = instr;
+    } else if(p->comp_prev != NULL && proc_fuse(p, p->comp_prev, p->comp_last)) {
+        p->comp_last = p->comp_prev;
+        p->comp_prev = NULL;
+    }
+
+    // Literals are kept track of while they come one after the other, up to
+    // the last few of them
+    if(w != p->w_push || p->comp_last != instr) {
+        p->comp_lit_count = 0;
+        return;
+    }
+    if(p->comp_lit_count == COMP_LITS) {
+        memmove(p->comp_lits, p->comp_lits + 1,
+                (COMP_LITS - 1) * sizeof(*p->comp_lits));
+        p->comp_lit_count -= 1;
+    }
+    p->comp_lits[p->comp_lit_count++] = before;
+}
+
+// Length of the body of a colon word, if it should be inlined, or else -1.
+// Only bodies that run straight to the exit at their end can be inlined
+int proc_inline_len(Processor *p, Word *w) {
+    if(!word_is_colon(w) || !check_flag(w->flags, FLAG_straight)
+            || check_flag(w->flags, FLAG_noinline | FLAG_immediate))
+        return -1;
+    int len = 0;
+    while(code_xt(p, w->as.body[len]) != p->w_exit)
+        len += code_decode(p, &w->as.body[len]).len;
+    if(len > p->inline_max && !check_flag(w->flags, FLAG_inline))
+        return -1;
+    return len;
+}
+
+// Compiles a call to a word. Small colon words are inlined instead, by
+// compiling a copy of their body. The copy is a snapshot, so, just like a
+// call, it is not affected by redefining any word later
+void proc_compile(Processor *p, Word *w) {
+    if(w->op == OP_constant) {
+        proc_compile_op(p, p->w_push, &w->as.value);
+        return;
+    }
+    int len = proc_inline_len(p, w);
+    if(len < 0) {
+        proc_compile_op(p, w, NULL);
+        return;
+    }
+    for(Code *ip = w->as.body; ip < w->as.body + len; ) {
+        Instr in = code_decode(p, ip);
+        proc_compile_op(p, in.xt, &in.arg);
+        ip += in.len;
+    }
+}
+
+void proc_comp_push(Processor *p, Value val) {
+    proc_compile_op(p, p->w_push, &val);
+}
+
+// Cells compiled by other means can't be fused with what came before
+void proc_comp_fence(Processor *p) {
+    p->comp_last = p->comp_prev = NULL;
+    p->comp_lit_count = 0;
+}
+
+// Control structures are compiled with the data stack holding the places
+// they still have to resolve: the operands of forward branches and the
+// targets of backward ones. Fusion doesn't cross either
+
+// Compiles a branch, which is resolved later, and returns its operand
+Code *proc_comp_branch(Processor *p, Opcode op) {
+    proc_compile_op(p, p->prims[op], &(Value){ .num = 0 });
+    proc_comp_fence(p);
+    p->comp_straight = false;
+    return (Code*)p->here - 1;
+}
+
+// Marks the current position as the target of a branch, and returns it
+Code *proc_comp_target(Processor *p) {
+    proc_comp_fence(p);
+    p->comp_straight = false;
+    return (Code*)p->here;
+}
+
+void proc_resolve(Processor *p, Code *operand, Code *target) {
+    ptrdiff_t offset = target - operand;
+#if BKF_COMPACT
+    if(offset < INT16_MIN || offset > INT16_MAX)
+        error(p, THROW_control, "branch too far for compact code");
+    *operand = (uint16_t)offset;
+#else
+    (void) p;
+    operand->num = offset;
+#endif // BKF_COMPACT
+}
+
+void proc_push_place(Processor *p, Code *place) {
+    proc_push(p, (Value){ .addr = (Value*)place });
+}
+
+// Pops a place left by a control structure in the current definition
+Code *proc_pop_place(Processor *p) {
+    Code *place = (Code*)proc_pop(p).addr;
+    if(place < p->comp_word->as.body || place > (Code*)p->here)
+        error(p, THROW_control, "unbalanced control structure");
+    return place;
+}
+
+// Works out the effect of a colon word from its body, following every path
+// through it with the depth of the stack relative to the entry. It is only
+// known if the depth is the same wherever paths meet, if every path ends
+// with the same depth, and if the effect of every word called is known
+Effect proc_analyse(Processor *p, Word *w) {
+    if(check_flag(w->flags, FLAG_raw)) return EFFECT_UNKNOWN;
+    Code *body = w->as.body;
+    int len = word_body_len(p, w, (Code*)p->here);
+    if(len < 0) return EFFECT_UNKNOWN;
+
+    // Depth before each instruction, or INT_MIN before it's reached, and
+    // the instructions reached whose paths are still to be followed
+    int *depths = get_mem(len * sizeof(*depths));
+    int *pending = get_mem(len * sizeof(*pending));
+    for(int i = 0; i < len; ++i) depths[i] = INT_MIN;
+    int pending_count = 0, low = 0, high = 0, end = INT_MIN;
+    bool known = true;
+    depths[0] = 0;
+    pending[pending_count++] = 0;
+    while(known && pending_count > 0) {
+        int i = pending[--pending_count];
+        int depth = depths[i];
+        for(;;) {
+            Instr in = code_decode(p, &body[i]);
+            Word *op = in.xt;
+            Effect e = op->effect;
+            if(op->op == OP_tail) e = in.arg.xt->effect;
+            else if(op->op == OP_frame)
+                e = (Effect){ .in = in.arg.num & 0xFF, .out = 0, .grow = 0 };
+            if(e.in < 0) {
+                known = false;
+                break;
+            }
+            if(depth - e.in < low) low = depth - e.in;
+            if(depth + e.grow > high) high = depth + e.grow;
+            depth += e.out - e.in;
+            if(op_ends(op->op)) {
+                if(end != INT_MIN && end != depth) known = false;
+                end = depth;
+                break;
+            }
+            int next = i + in.len;
+            if(op_branches(op->op)) {
+                int target = i + 1 + in.arg.num;
+                if(target >= len) known = false;
+                else if(depths[target] == INT_MIN) {
+                    depths[target] = depth;
+                    pending[pending_count++] = target;
+                } else if(depths[target] != depth) known = false;
+                if(op->op == OP_branch) break;
+            }
+            if(!known) break;
+            if(depths[next] != INT_MIN) {
+                if(depths[next] != depth) known = false;
+                break;
+            }
+            depths[next] = depth;
+            i = next;
+        }
+    }
+    free_mem(depths);
+    free_mem(pending);
+    // Words that never return, or with effects too big to keep, are unknown
+    if(!known || end == INT_MIN || -low > INT16_MAX || high > INT16_MAX
+            || end - low > INT16_MAX)
+        return EFFECT_UNKNOWN;
+    return (Effect){ .in = -low, .out = end - low, .grow = high };
+}
+
+// Records the effect of a word that was just defined, and, if it is known,
+// makes the word run unchecked
+void proc_settle(Processor *p, Word *w) {
+    w->effect = proc_analyse(p, w);
+    if(w->effect.in >= 0) w->op = OP_safe;
+}
+
+// Index of a local of the word being compiled, or -1. Later locals shadow
+// the earlier ones of the same name
+int proc_find_local(Processor *p, StringView name) {
+    for(int i = p->local_count - 1; i >= 0; --i)
+        if(p->locals[i].len == name.len
+                && strncasecmp(name.text, p->locals[i].text, name.len) == 0)
+            return i;
+    return -1;
+}
+
+// Compiles an access to a local, which finds it by its distance from the
+// top of the frame
+void proc_comp_local(Processor *p, Opcode op, int local) {
+    Value depth = { .num = p->local_count - 1 - local };
+    proc_compile_op(p, p->prims[op], &depth);
+}
+
+void proc_locals_clear(Processor *p) {
+    for(int i = 0; i < p->local_count; ++i) sv_free(p->locals[i]);
+    p->local_count = 0;
+}
+
+void proc_next(Processor *p) {
+    bool is_val = false;
+    StringView name = scan_word(&p->scan);
+    if(name.len == 0) return;
+    // Literals are recognized before looking the dictionary up, which means
+    // that words named like numbers can't shadow them
+    Value operand = { .num = 0 };
+    if(value_is_literal(name))
+        operand = value_read(name, &is_val);
+    // Locals shadow the words of the same name while they are in scope
+    int local = is_val ? -1 : proc_find_local(p, name);
+    if(local >= 0) {
+        proc_comp_local(p, OP_local_fetch, local);
+        return;
+    }
+    Word *w = is_val ? NULL : proc_find(p, name);
+    if(w == NULL) {
+        if(!is_val) error_undef(p, name);
+        if(proc_compile_mode(p))
+            proc_comp_push(p, operand);
+        else proc_push(p, operand);
+        return;
+    }
+    if(proc_compile_mode(p)) {
+        if(check_flag(w->flags, FLAG_immediate))
+            execute_word(p, w);
+        else proc_compile(p, w);
+        return;
+    }
+    if(check_flag(w->flags, FLAG_comp_only))
+        error_comp_only(p, name);
+    else execute_word(p, w);
+}
+
+// -----------------------------------------------------------------------------
+
+// Runs what is left of the source loaded in the scanner, stopping at the
+// first error. Returns whether there was none
+bool run_scan(Processor *p) {
+    CatchFrame frame;
+    catch_push(p, &frame, false);
+    if(setjmp(frame.env) != 0) {
+        // A definition cut short by an error is left hidden
+        p->comp_word = NULL;
+        proc_locals_clear(p);
+        proc_comp_fence(p);
+        return false;
+    }
+    while(!scan_end(&p->scan)) proc_next(p);
+    catch_pop(p);
+    return true;
+}
+
+bool run_source(Processor *p, StringView source) {
+    load_source(p, source);
+    return run_scan(p);
+}
+
+// Runs a whole stream. Files are mapped to memory and scanned in place,
+// anything else, like a pipe, is read a chunk at a time instead of all at
+// once or line by line
+bool run_stream(Processor *p, FILE *fp) {
+    bool v = p->verbose;
+    p->verbose = true;
+    StringView mapped = file_map(fp);
+    if(mapped.text != NULL) load_source(p, mapped);
+    else scan_init_stream(&p->scan, fp);
+    bool ok = run_scan(p);
+    if(mapped.text != NULL) file_unmap(mapped);
+    else scan_free(&p->scan);
+    p->verbose = v;
+    return ok;
+}
+
+void run_file(Processor *p, const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL) return;
+    run_stream(p, fp);
+    fclose(fp);
+}
+
+// -----------------------------------------------------------------------------
+
+// An image is a snapshot of the dictionary space, written after a header
+// that is padded to a whole page, so that it can be mapped straight back
+#define IMAGE_MAGIC "bkfimage"
+#define IMAGE_VERSION 9
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // Sizes of a few things, to reject images from other builds
+    uint32_t cell_size, code_size, word_size;
+    uint32_t code_count;           // code words registered on startup
+    uint64_t offset;               // of the dictionary space in the file
+    uint64_t base, size;           // address and used size of the space
+    uint64_t fence;                // end of the builtin words in it
+    uint64_t tasks;                // address of the newest task
+    uint64_t dict, w_exit, w_push, w_tail; // addresses of a few words
+} ImageHeader;
+
+int proc_code_index(const Processor *p, CodeWordFn fn) {
+    for(int i = 0; i < p->code_count; ++i)
+        if(p->codes[i].fn == fn) return i;
+    return -1;
+}
+
+// Returns whether the image could be written
+bool proc_save_image(Processor *p, const char *filename) {
+    size_t size = p->here - p->space;
+    ImageHeader header = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .cell_size = sizeof(Value),
+        .code_size = sizeof(Code),
+        .word_size = sizeof(Word),
+        .code_count = p->code_count,
+        .offset = page_size(),
+        .base = (uintptr_t)p->space,
+        .size = size,
+        .fence = p->fence - p->space,
+        .tasks = (uintptr_t)p->tasks,
+        .dict = (uintptr_t)p->dict,
+        .w_exit = (uintptr_t)p->w_exit,
+        .w_push = (uintptr_t)p->w_push,
+        .w_tail = (uintptr_t)p->w_tail,
+    };
+    while(header.offset < sizeof(header)) header.offset *= 2;
+
+    // The function pointers of code words are swapped for their indices in
+    // a copy of the space, which is what gets written
+    uint8_t *copy = get_mem(size + 1);
+    memcpy(copy, p->space, size);
+    for(Word *w = p->dict; w != NULL; w = w->prev) {
+        Word *w_copy = (Word*)(copy + ((uint8_t*)w - p->space));
+#if BKF_JIT
+        // Native code isn't saved, so words start out interpreted again
+        w_copy->calls = 0;
+        w_copy->native = NULL;
+        if(w->op == OP_jit)
+            w_copy->op = w->effect.in >= 0 ? OP_safe : OP_colon;
+#endif // BKF_JIT
+        if(w->op != OP_code) continue;
+        w_copy->as.code_index = proc_code_index(p, w->as.code);
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    bool ok = fp != NULL;
+    if(ok) {
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        for(size_t i = sizeof(header); ok && i < header.offset; ++i)
+            ok = fputc(0, fp) != EOF;
+        if(ok && size > 0) ok = fwrite(copy, size, 1, fp) == 1;
+        if(fclose(fp) != 0) ok = false;
+    }
+    free_mem(copy);
+    return ok;
+}
+
+// Replaces the dictionary with the one in an image. The image is mapped at
+// the address it was saved from, so the pointers in it remain valid, and
+// only code words have to be bound to their C functions again
+void proc_load_image(Processor *p, const char *filename) {
+    if(p->parent != NULL || p->workers != NULL)
+        error(p, THROW_worker, "can't replace words shared with workers");
+    ImageHeader header;
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL) error(p, THROW_file, "can't open image");
+    if(fread(&header, sizeof(header), 1, fp) != 1
+            || memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != IMAGE_VERSION) {
+        fclose(fp);
+        error(p, THROW_file, "not an image");
+    }
+    if(header.cell_size != sizeof(Value) || header.code_size != sizeof(Code)
+            || header.word_size != sizeof(Word)
+            || header.code_count != (uint32_t)p->code_count) {
+        fclose(fp);
+        error(p, THROW_file, "image was saved by a different build");
+    }
+    if(header.base != (uintptr_t)p->space
+            || header.size > (uint64_t)(p->space_end - p->space)
+            || header.fence > header.size) {
+        fclose(fp);
+        error(p, THROW_file, "image doesn't fit in the dictionary space");
+    }
+#if HAVE_MMAP
+    // A mapping past the end of the file would fault when first touched,
+    // instead of failing here
+    struct stat st;
+    if(fstat(fileno(fp), &st) < 0
+            || (uint64_t)st.st_size < header.offset + header.size) {
+        fclose(fp);
+        error(p, THROW_file, "image is truncated");
+    }
+#endif // HAVE_MMAP
+
+    bool mapped = false;
+#if HAVE_MMAP
+    size_t page = page_size();
+    if(header.size > 0 && header.offset % page == 0) {
+        size_t len = (header.size + page - 1) / page * page;
+        void *mem = mmap(p->space, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fileno(fp), header.offset);
+        mapped = mem != MAP_FAILED;
+    }
+#endif // HAVE_MMAP
+    if(!mapped && (fseek(fp, header.offset, SEEK_SET) != 0
+                || fread(p->space, 1, header.size, fp) != header.size)) {
+        fclose(fp);
+        error(p, THROW_file, "can't read image");
+    }
+    fclose(fp);
+
+    p->here = p->space + header.size;
+    p->fence = p->space + header.fence;
+    p->dict = (Word*)(uintptr_t)header.dict;
+    p->w_exit = (Word*)(uintptr_t)header.w_exit;
+    p->w_push = (Word*)(uintptr_t)header.w_push;
+    p->w_tail = (Word*)(uintptr_t)header.w_tail;
+    // Tasks were saved with pointers to the processor that saved them, so
+    // they come back asleep, out of a ring that only has the main task
+    p->tasks = (Task*)(uintptr_t)header.tasks;
+    for(Task *t = p->tasks; t != NULL; t = t->older)
+        *t = (Task){
+            .older = t->older, .owner = p,
+            .ds = t->ds, .rs = t->rs, .ls = t->ls
+        };
+    p->main_task.next = &p->main_task;
+    for(Word *w = p->dict; w != NULL; w = w->prev) {
+        if(w->op != OP_code) continue;
+        uintptr_t i = w->as.code_index;
+        if(i >= (uintptr_t)p->code_count
+                || strcmp(word_name(w).text, p->codes[i].name) != 0)
+            error(p, THROW_file, "image was saved by a different build");
+        w->as.code = p->codes[i].fn;
+    }
+    memset(p->prims, 0, sizeof(p->prims));
+#if BKF_COMPACT
+    p->token_count = 0;
+#endif // BKF_COMPACT
+    for(Word *w = p->dict; w != NULL; w = w->prev) {
+        bool prim = w->op != OP_code && w->op != OP_constant
+            && w->op != OP_marker && !word_is_colon(w);
+        if(prim) p->prims[w->op] = w;
+#if BKF_COMPACT
+        p->tokens[w->token] = w;
+        if(w->token >= p->token_count) p->token_count = w->token + 1;
+#endif // BKF_COMPACT
+    }
+    proc_thaw(p);
+    proc_reindex(p);
+}
+
+// Loads an image from outside of the interpreter, where there's no handler
+// for the errors. Returns whether it could be
+bool load_image(Processor *p, const char *filename) {
+    CatchFrame frame;
+    catch_push(p, &frame, false);
+    if(setjmp(frame.env) != 0) return false;
+    proc_load_image(p, filename);
+    catch_pop(p);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+#if BKF_WORKERS
+# include <pthread.h>
+
+// A processor running a word on a thread of its own. It shares the frozen
+// words of the processor that spawned it, and so costs little more than its
+// stacks. It ends when the word returns, leaving a result on its stack
+typedef struct worker {
+    Processor proc;
+    struct worker *next; // spawned by the same processor
+    pthread_t thread;
+    Word *xt;
+    int thrown; // code of the error that ended the worker, or 0
+} Worker;
+
+// Sets up a worker on top of the words of its parent, which must be frozen
+void proc_init_worker(Processor *p, Processor *parent) {
+    proc_setup(p, parent->ds.limit - parent->ds.base + 1,
+            parent->rs.limit - parent->rs.base + 1, BKF_WORKER_DICT_SIZE);
+    scan_init(&p->scan, (StringView){ .text = "", .len = 0 });
+    p->out.unbuffered = parent->out.unbuffered;
+    p->verbose = parent->verbose;
+    p->inline_max = parent->inline_max;
+    p->jit_threshold = parent->jit_threshold;
+    p->parent = parent;
+    p->dict = parent->dict;
+    p->frozen = parent->frozen;
+    p->w_exit = parent->w_exit;
+    p->w_push = parent->w_push;
+    p->w_tail = parent->w_tail;
+    memcpy(p->prims, parent->prims, sizeof(p->prims));
+#if BKF_COMPACT
+    // The frozen words keep their tokens, and the worker's come after them
+    memcpy(p->tokens, parent->tokens,
+            parent->token_count * sizeof(*p->tokens));
+    p->token_count = parent->token_count;
+#endif // BKF_COMPACT
+}
+
+void *worker_main(void *arg) {
+    Worker *wk = arg;
+    Processor *p = &wk->proc;
+    CatchFrame frame;
+    catch_push(p, &frame, false);
+    if(setjmp(frame.env) == 0) {
+        execute_word(p, wk->xt);
+        catch_pop(p);
+    } else wk->thrown = p->thrown;
+    out_flush(&p->out);
+    return NULL;
+}
+
+// Starts a worker running xt, with x on its stack
+Worker *proc_spawn(Processor *p, Word *xt, Value x) {
+    proc_freeze(p);
+    out_flush(&p->out);
+    Worker *wk = get_mem(sizeof(*wk));
+    proc_init_worker(&wk->proc, p);
+    proc_push(&wk->proc, x);
+    wk->xt = xt;
+    wk->thrown = 0;
+    if(pthread_create(&wk->thread, NULL, worker_main, wk) != 0) {
+        proc_free(&wk->proc);
+        free_mem(wk);
+        error(p, THROW_worker, "can't start a worker");
+    }
+    wk->next = p->workers;
+    p->workers = wk;
+    return wk;
+}
+
+// Waits for a worker to end, and frees it. Returns the error code it ended
+// with, or 0, and the cell left on top of its stack in result
+int proc_join(Processor *p, Worker *wk, Value *result) {
+    Worker **link = &p->workers;
+    while(*link != NULL && *link != wk) link = &(*link)->next;
+    if(*link == NULL) error(p, THROW_argument, "not a worker");
+    *link = wk->next;
+    pthread_join(wk->thread, NULL);
+    Stack *ds = &wk->proc.ds;
+    *result = ds->sp >= ds->base ? *ds->sp : (Value){ .num = 0 };
+    int thrown = wk->thrown;
+    proc_free(&wk->proc);
+    free_mem(wk);
+    return thrown;
+}
+
+// Workers share the words of the processor, so it waits for them before
+// being freed
+void proc_join_all(Processor *p) {
+    Value result;
+    while(p->workers != NULL) proc_join(p, p->workers, &result);
+}
+
+// Times a channel is tried again before its user goes to sleep on it
+#define CHAN_SPINS 256
+
+// Channels pass cells between processors, through a bounded ring buffer.
+// A channel for any number of senders and receivers synchronizes them on
+// each slot: its sequence number tells whether the slot has been filled for
+// the current pass over the ring or emptied for the next. In a channel for
+// just one sender and one receiver, each only has to see the position of
+// the other. Either way, sending and receiving are lock free until the
+// channel is found full or empty, for a while
+typedef struct {
+    atomic_size_t seq;
+    Value value;
+} ChanSlot;
+
+typedef struct {
+    ChanSlot *slots;
+    size_t mask; // capacity - 1, the capacity being a power of two
+    bool single; // just one sender and one receiver?
+    // The positions of the senders and the receivers are apart, so that
+    // they don't share a cache line, each with the other seen last
+    char pad0[64];
+    atomic_size_t tail; // where the next cell is sent
+    size_t head_seen;
+    char pad1[64];
+    atomic_size_t head; // where the next cell is received from
+    size_t tail_seen;
+    char pad2[64];
+    // Where senders and receivers sleep, when they've waited long enough
+    atomic_int senders_parked, receivers_parked;
+    pthread_mutex_t lock;
+    pthread_cond_t writable, readable;
+} Channel;
+
+static inline void cpu_relax(void) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) && defined(__GNUC__)
+    __asm__ volatile("yield");
+#endif
+}
+
+Channel *chan_new(Processor *p, i32 capacity, bool single) {
+    if(capacity <= 0 || capacity > (1 << 24))
+        error(p, THROW_argument, "invalid channel capacity");
+    // With a single slot, filled for this pass and emptied for the next
+    // would be the same sequence number, so the ring has at least two
+    size_t size = single ? 1 : 2;
+    while(size < (size_t)capacity) size *= 2;
+    Channel *c = get_mem(sizeof(*c));
+    memset(c, 0, sizeof(*c));
+    c->slots = get_mem(size * sizeof(*c->slots));
+    for(size_t i = 0; i < size; ++i) atomic_init(&c->slots[i].seq, i);
+    c->mask = size - 1;
+    c->single = single;
+    atomic_init(&c->tail, 0);
+    atomic_init(&c->head, 0);
+    atomic_init(&c->senders_parked, 0);
+    atomic_init(&c->receivers_parked, 0);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->writable, NULL);
+    pthread_cond_init(&c->readable, NULL);
+    return c;
+}
+
+void chan_free(Channel *c) {
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->writable);
+    pthread_cond_destroy(&c->readable);
+    free_mem(c->slots);
+    free_mem(c);
+}
+
+bool chan_try_send(Channel *c, Value x) {
+    size_t pos = atomic_load_explicit(&c->tail, memory_order_relaxed);
+    if(c->single) {
+        if(pos - c->head_seen > c->mask) {
+            c->head_seen = atomic_load_explicit(&c->head,
+                    memory_order_acquire);
+            if(pos - c->head_seen > c->mask) return false;
+        }
+        c->slots[pos & c->mask].value = x;
+        atomic_store_explicit(&c->tail, pos + 1, memory_order_release);
+        return true;
+    }
+    for(;;) {
+        ChanSlot *slot = &c->slots[pos & c->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)(seq - pos);
+        if(diff < 0) return false; // still to be emptied, so full
+        if(diff > 0)
+            pos = atomic_load_explicit(&c->tail, memory_order_relaxed);
+        else if(atomic_compare_exchange_weak_explicit(&c->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+            slot->value = x;
+            atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+            return true;
+        }
+    }
+}
+
+bool chan_try_recv(Channel *c, Value *x) {
+    size_t pos = atomic_load_explicit(&c->head, memory_order_relaxed);
+    if(c->single) {
+        if(pos == c->tail_seen) {
+            c->tail_seen = atomic_load_explicit(&c->tail,
+                    memory_order_acquire);
+            if(pos == c->tail_seen) return false;
+        }
+        *x = c->slots[pos & c->mask].value;
+        atomic_store_explicit(&c->head, pos + 1, memory_order_release);
+        return true;
+    }
+    for(;;) {
+        ChanSlot *slot = &c->slots[pos & c->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)(seq - (pos + 1));
+        if(diff < 0) return false; // still to be filled, so empty
+        if(diff > 0)
+            pos = atomic_load_explicit(&c->head, memory_order_relaxed);
+        else if(atomic_compare_exchange_weak_explicit(&c->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+            *x = slot->value;
+            atomic_store_explicit(&slot->seq, pos + c->mask + 1,
+                    memory_order_release);
+            return true;
+        }
+    }
+}
+
+// Wakes whoever sleeps on cond, if anyone. Sleepers count themselves before
+// trying the channel one last time, and the cell was sent, or its slot
+// freed, before they're counted here, so one of the two sees the other
+void chan_wake(Channel *c, atomic_int *parked, pthread_cond_t *cond) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(parked, memory_order_relaxed) == 0) return;
+    pthread_mutex_lock(&c->lock);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Sends a cell, waiting while the channel is full
+void chan_send(Channel *c, Value x) {
+    for(int i = 0; !chan_try_send(c, x); ++i) {
+        if(i < CHAN_SPINS) {
+            cpu_relax();
+            continue;
+        }
+        pthread_mutex_lock(&c->lock);
+        atomic_fetch_add(&c->senders_parked, 1);
+        while(!chan_try_send(c, x)) pthread_cond_wait(&c->writable, &c->lock);
+        atomic_fetch_sub(&c->senders_parked, 1);
+        pthread_mutex_unlock(&c->lock);
+        break;
+    }
+    chan_wake(c, &c->receivers_parked, &c->readable);
+}
+
+// Receives a cell, waiting while the channel is empty
+Value chan_recv(Channel *c) {
+    Value x;
+    for(int i = 0; !chan_try_recv(c, &x); ++i) {
+        if(i < CHAN_SPINS) {
+            cpu_relax();
+            continue;
+        }
+        pthread_mutex_lock(&c->lock);
+        atomic_fetch_add(&c->receivers_parked, 1);
+        while(!chan_try_recv(c, &x))
+            pthread_cond_wait(&c->readable, &c->lock);
+        atomic_fetch_sub(&c->receivers_parked, 1);
+        pthread_mutex_unlock(&c->lock);
+        break;
+    }
+    chan_wake(c, &c->senders_parked, &c->writable);
+    return x;
+}
+#else
+void proc_join_all(Processor *p) {
+    (void) p;
+}
+#endif // BKF_WORKERS
+
+// -----------------------------------------------------------------------------
+
+int profile_entry_cmp(const void *a, const void *b) {
+    uint64_t sa = ((const ProfileEntry*)a)->self;
+    uint64_t sb = ((const ProfileEntry*)b)->self;
+    return (sa < sb) - (sa > sb);
+}
+
+// Lists the words timed so far, those that took the most time first
+void proc_profile_report(Processor *p) {
+    Profile *prof = &p->prof;
+    ProfileEntry *sorted = get_mem(prof->count * sizeof(*sorted) + 1);
+    int n = 0;
+    for(int i = 0; i < prof->size; ++i)
+        if(prof->entries[i].word != NULL) sorted[n++] = prof->entries[i];
+    qsort(sorted, n, sizeof(*sorted), profile_entry_cmp);
+
+    char line[96];
+    snprintf(line, sizeof(line), "%12s %16s %16s  word (%s)\n",
+            "calls", "self", "total", PROFILE_UNIT);
+    out_str(&p->out, line);
+    for(int i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "%12" PRIu64 " %16" PRIu64 " %16" PRIu64
+                "  ", sorted[i].calls, sorted[i].self, sorted[i].total);
+        out_str(&p->out, line);
+        StringView name = word_name(sorted[i].word);
+        out_write(&p->out, name.text, name.len);
+        out_char(&p->out, '\n');
+    }
+    free_mem(sorted);
+}
+
+// The trace is dumped with plain writes, formatted by hand, since stdio
+// can't be used from a signal handler
+#ifdef _MSC_VER
+# define write_fd _write
+#else
+# define write_fd write
+#endif // _MSC_VER
+
+typedef struct {
+    char text[160];
+    int len;
+} TraceLine;
+
+void trace_str(TraceLine *l, const char *text, int len) {
+    for(int i = 0; i < len && l->len < (int)sizeof(l->text); ++i)
+        l->text[l->len++] = text[i];
+}
+
+void trace_num(TraceLine *l, uint64_t n, int base) {
+    char digits[24];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = "0123456789abcdef"[n % base];
+        n /= base;
+    } while(n != 0);
+    trace_str(l, &digits[i], sizeof(digits) - i);
+}
+
+void trace_int(TraceLine *l, i32 n) {
+    if(n < 0) trace_str(l, "-", 1);
+    trace_num(l, n < 0 ? -(uint64_t)n : (uint64_t)n, 10);
+}
+
+// Writes the entries in the trace, from the oldest to the newest
+void trace_write(const Trace *t, int fd) {
+    unsigned end = atomic_load_explicit(&t->count, memory_order_acquire);
+    unsigned start = end > BKF_TRACE_SIZE ? end - BKF_TRACE_SIZE : 0;
+    for(unsigned n = start; n != end; ++n) {
+        const TraceEntry *e = &t->entries[n & (BKF_TRACE_SIZE - 1)];
+        TraceLine l = { .len = 0 };
+        trace_num(&l, n, 10);
+        trace_str(&l, " ", 1);
+        StringView name = word_name(e->xt);
+        trace_str(&l, name.text, name.len);
+        trace_str(&l, " ip=0x", 6);
+        trace_num(&l, (uintptr_t)e->ip, 16);
+        trace_str(&l, " depth=", 7);
+        trace_int(&l, e->depth);
+        if(e->depth > 0) {
+            trace_str(&l, " tos=", 5);
+            trace_int(&l, e->tos.num);
+            trace_str(&l, " (0x", 4);
+            trace_num(&l, (uintptr_t)e->tos.addr, 16);
+            trace_str(&l, ")", 1);
+        }
+        trace_str(&l, "\n", 1);
+        if(write_fd(fd, l.text, l.len) < 0) return;
+    }
+}
+
+void proc_trace_dump(Processor *p) {
+    out_flush(&p->out);
+    const char header[] = "trace, oldest first:\n";
+    if(write_fd(2, header, sizeof(header) - 1) < 0) return;
+    trace_write(&p->trace, 2);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <signal.h>
+
+// The processor whose trace is dumped on a signal, and the processors that
+// installed the handlers, with the ones they replaced
+static Processor *volatile trace_target = NULL;
+static int trace_users = 0;
+static const int trace_signals[] = { SIGUSR1, SIGSEGV, SIGBUS, SIGFPE };
+static struct sigaction trace_saved[4];
+
+void trace_signal(int sig) {
+    Processor *p = trace_target;
+    if(p != NULL) {
+        const char header[] = "signal received, trace, oldest first:\n";
+        if(write_fd(2, header, sizeof(header) - 1) >= 0)
+            trace_write(&p->trace, 2);
+    }
+    // Crashes still crash, the handler having been reset to the default
+    if(sig != SIGUSR1) raise(sig);
+}
+
+// Dumps the trace of the processor on SIGUSR1, and on crashes. Workers
+// leave the target to the processor that spawned them, which outlives them
+void trace_install(Processor *p) {
+    if(p->parent != NULL) return;
+    trace_target = p;
+    if(p->trace_handled) return;
+    p->trace_handled = true;
+    if(trace_users++ > 0) return;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_signal;
+    sigemptyset(&sa.sa_mask);
+    for(int i = 0; i < 4; ++i) {
+        sa.sa_flags = trace_signals[i] == SIGUSR1 ? SA_RESTART : SA_RESETHAND;
+        sigaction(trace_signals[i], &sa, &trace_saved[i]);
+    }
+}
+
+// Stops dumping the trace of a processor about to be freed, and puts the
+// handlers from before back once no processor uses them
+void trace_uninstall(Processor *p) {
+    if(!p->trace_handled) return;
+    p->trace_handled = false;
+    if(trace_target == p) trace_target = NULL;
+    if(--trace_users > 0) return;
+    for(int i = 0; i < 4; ++i)
+        sigaction(trace_signals[i], &trace_saved[i], NULL);
+}
+#else
+void trace_install(Processor *p) {
+    (void) p;
+}
+
+void trace_uninstall(Processor *p) {
+    (void) p;
+}
+#endif // __unix__ || __APPLE__
+
+// -----------------------------------------------------------------------------
+
+// The library interface, in bkf.h. Its functions are called from outside of
+// the interpreter, so those that can end with an error install a handler
+// for it, as run_scan does
+
+Processor *bkf_new(const BkfConfig *config) {
+    BkfConfig c = config != NULL ? *config : (BkfConfig){ 0 };
+    Processor *p = get_mem(sizeof(*p));
+    proc_init(p, c.ds_size > 0 ? c.ds_size : BKF_DS_SIZE,
+            c.rs_size > 0 ? c.rs_size : BKF_RS_DEPTH,
+            c.dict_size > 0 ? c.dict_size : BKF_DICT_SIZE);
+    p->out.unbuffered = c.unbuffered;
+    if(c.inline_max > 0) p->inline_max = c.inline_max;
+    p->profiling = c.profile;
+    p->tracing = c.trace;
+    if(c.trace) trace_install(p);
+#if BKF_JIT
+    p->jit_threshold = c.jit_threshold;
+#endif // BKF_JIT
+    if(c.image != NULL) {
+        if(!load_image(p, c.image)) {
+            bkf_free(p);
+            return NULL;
+        }
+    } else if(c.prelude != NULL) run_file(p, c.prelude);
+    return p;
+}
+
+void bkf_free(Processor *p) {
+    proc_free(p);
+    free_mem(p);
+}
+
+bool bkf_has_jit(void) {
+    return BKF_JIT;
+}
+
+bool bkf_eval(Processor *p, const char *source) {
+    return run_source(p, sv_init((char*)source));
+}
+
+bool bkf_eval_stream(Processor *p, FILE *fp) {
+    return run_stream(p, fp);
+}
+
+Word *bkf_find(Processor *p, const char *name) {
+    return proc_find(p, sv_init((char*)name));
+}
+
+bool bkf_call(Processor *p, Word *w) {
+    CatchFrame frame;
+    catch_push(p, &frame, false);
+    if(setjmp(frame.env) != 0) return false;
+    execute_word(p, w);
+    catch_pop(p);
+    return true;
+}
+
+bool bkf_push(Processor *p, Value v) {
+    if(p->ds.sp >= p->ds.limit) return false;
+    *++p->ds.sp = v;
+    return true;
+}
+
+bool bkf_pop(Processor *p, Value *v) {
+    if(p->ds.sp < p->ds.base) return false;
+    *v = *p->ds.sp--;
+    return true;
+}
+
+int bkf_depth(Processor *p) {
+    return stack_depth(&p->ds);
+}
+
+Word *code_word(Processor *p, char *name, CodeWordFn body, uint8_t flags);
+
+Word *bkf_register(Processor *p, const char *name, CodeWordFn fn) {
+    CatchFrame frame;
+    catch_push(p, &frame, false);
+    if(setjmp(frame.env) != 0) return NULL;
+    Word *w = code_word(p, (char*)name, fn, 0);
+    catch_pop(p);
+    return w;
+}
+
+_Noreturn void bkf_throw(Processor *p, int code, const char *msg) {
+    error(p, code, msg);
+}
+
+void bkf_print(Processor *p, const char *text) {
+    out_str(&p->out, text);
+}
+
+void bkf_flush(Processor *p) {
+    out_flush(&p->out);
+}
+
+void bkf_profile_report(Processor *p) {
+    proc_profile_report(p);
+}
+
+// -----------------------------------------------------------------------------
+
+Word *code_word(Processor *p, char *name, CodeWordFn body, uint8_t flags) {
+    StringView sv = { .text = name, .len = strlen(name) };
+    Word *w = proc_create(p, sv, FLAG_code | flags);
+    w->as.code = body;
+    proc_register_code(p, name, body);
+    return w;
+}
+
+Word *prim_word(Processor *p, char *name, Opcode op, uint8_t flags) {
+    StringView sv = { .text = name, .len = strlen(name) };
+    Word *w = proc_create(p, sv, FLAG_code | flags);
+    w->op = op;
+    w->effect = op_effects[op];
+    if(p->prims[op] == NULL) p->prims[op] = w;
+    return w;
+}
+
+void w_define(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    p->comp_word = proc_create(p, name, FLAG_hidden);
+    proc_comp_fence(p);
+    p->comp_straight = true;
+    proc_locals_clear(p);
+}
+
+void w_end(Processor *p) {
+    if(p->comp_straight) p->comp_word->flags |= FLAG_straight;
+    // A call to a colon word right before the end becomes a jump to it,
+    // unless the frame of the locals has to be dropped after the call
+    Code *last = p->comp_last;
+    if(last != NULL && word_is_colon(code_xt(p, *last))
+            && p->local_count == 0) {
+        Word *callee = code_xt(p, *last);
+        *last = code_cell(p->w_tail);
+        proc_comma_operand(p, OP_tail, (Value){ .xt = callee });
+        p->comp_word->flags &= ~FLAG_straight;
+    }
+    // The exit is unreachable after a tail call, but still ends the body
+    proc_compile(p, p->w_exit);
+    proc_comp_fence(p);
+    proc_settle(p, p->comp_word);
+    p->comp_word->flags &= ~FLAG_hidden;
+    p->comp_word = NULL;
+    proc_locals_clear(p);
+}
+
+// -----------------------------------------------------------------------------
+
+void w_if(Processor *p) {
+    proc_push_place(p, proc_comp_branch(p, OP_zero_branch));
+}
+
+void w_else(Processor *p) {
+    Code *orig = proc_pop_place(p);
+    Code *operand = proc_comp_branch(p, OP_branch);
+    proc_resolve(p, orig, proc_comp_target(p));
+    proc_push_place(p, operand);
+}
+
+void w_then(Processor *p) {
+    Code *orig = proc_pop_place(p);
+    proc_resolve(p, orig, proc_comp_target(p));
+}
+
+void w_begin(Processor *p) {
+    proc_push_place(p, proc_comp_target(p));
+}
+
+void w_until(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    proc_resolve(p, proc_comp_branch(p, OP_zero_branch), dest);
+}
+
+void w_again(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    proc_resolve(p, proc_comp_branch(p, OP_branch), dest);
+}
+
+void w_while(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    proc_push_place(p, proc_comp_branch(p, OP_zero_branch));
+    proc_push_place(p, dest);
+}
+
+void w_repeat(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    Code *orig = proc_pop_place(p);
+    proc_resolve(p, proc_comp_branch(p, OP_branch), dest);
+    proc_resolve(p, orig, proc_comp_target(p));
+}
+
+void w_do(Processor *p) {
+    proc_compile_op(p, p->prims[OP_do], NULL);
+    proc_push_place(p, proc_comp_target(p));
+}
+
+void w_loop(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    proc_resolve(p, proc_comp_branch(p, OP_loop), dest);
+}
+
+void w_plus_loop(Processor *p) {
+    Code *dest = proc_pop_place(p);
+    proc_resolve(p, proc_comp_branch(p, OP_plus_loop), dest);
+}
+
+// -----------------------------------------------------------------------------
+
+// Comments, which work both inside and outside definitions
+void w_line_comment(Processor *p) {
+    scan_skip_past(&p->scan, '\n');
+}
+
+void w_comment(Processor *p) {
+    scan_skip_past(&p->scan, ')');
+}
+
+void w_immediate(Processor *p) {
+    p->comp_word->flags |= FLAG_immediate;
+}
+
+// Compiles a call to the word being defined, which is hidden until its end
+void w_recurse(Processor *p) {
+    proc_compile_op(p, p->comp_word, NULL);
+}
+
+// Declares the locals of the word being defined, as in {: a b | c -- d :}.
+// Those before the bar are taken from the data stack, the last one from
+// its top, and the ones after it start at 0. What follows -- is a comment
+void w_locals(Processor *p) {
+    // The frame is made once, so it must be before anything that returns
+    // or branches, and only one per word
+    if(!p->comp_straight)
+        error(p, THROW_control, "locals must come before any branch or exit");
+    int init = -1;
+    bool comment = false;
+    for(;;) {
+        StringView name = scan_word(&p->scan);
+        if(name.len == 0)
+            error(p, THROW_argument, "locals without a closing :}");
+        if(sv_is(name, ":}")) break;
+        if(comment) continue;
+        if(sv_is(name, "--")) comment = true;
+        else if(sv_is(name, "|")) {
+            if(init >= 0) error(p, THROW_argument, "locals with two bars");
+            init = p->local_count;
+        } else if(p->local_count == BKF_LOCALS_MAX)
+            error(p, THROW_argument, "too many locals");
+        else {
+            char *text = get_mem(name.len);
+            memcpy(text, name.text, name.len);
+            p->locals[p->local_count++] = (StringView){ text, name.len };
+        }
+    }
+    if(p->local_count == 0) return;
+    Value frame = frame_operand(p->local_count,
+            init < 0 ? p->local_count : init);
+    proc_compile_op(p, p->prims[OP_frame], &frame);
+    p->comp_straight = false;
+}
+
+// Compiles a store into a local
+void w_to(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    int local = proc_find_local(p, name);
+    if(local < 0) error_undef(p, name);
+    proc_comp_local(p, OP_local_store, local);
+}
+
+void w_inline(Processor *p) {
+    p->comp_word->flags |= FLAG_inline;
+}
+
+void w_noinline(Processor *p) {
+    p->comp_word->flags |= FLAG_noinline;
+}
+
+void w_quote(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_find(p, name);
+    if(w == NULL) error_undef(p, name);
+    proc_push(p, (Value){ .xt = w });
+}
+
+// Runs a word, and pushes the code of the error it throws, or else 0. The
+// data stack is restored to its depth before the word ran
+void w_catch(Processor *p) {
+    Word *w = proc_pop(p).xt;
+    CatchFrame frame;
+    catch_push(p, &frame, true);
+    if(setjmp(frame.env) != 0) {
+        proc_push(p, (Value){ .num = p->thrown });
+        return;
+    }
+    execute_word(p, w);
+    catch_pop(p);
+    proc_push(p, (Value){ .num = 0 });
+}
+
+void w_throw(Processor *p) {
+    i32 code = proc_pop(p).num;
+    if(code == 0) return;
+    char msg[32];
+    snprintf(msg, sizeof(msg), "exception %" PRId32, code);
+    error(p, code, msg);
+}
+
+#if BKF_WORKERS
+// Runs xt on a worker, with x on its stack ( x xt -- worker )
+void w_spawn(Processor *p) {
+    Word *xt = proc_pop(p).xt;
+    Value x = proc_pop(p);
+    Worker *wk = proc_spawn(p, xt, x);
+    proc_push(p, (Value){ .addr = (Value*)wk });
+}
+
+// Waits for a worker, and pushes what it left on top of its stack. The
+// error it ended with, if any, is thrown again, having been reported by
+// the worker already ( worker -- x )
+void w_join(Processor *p) {
+    Worker *wk = (Worker*)proc_pop(p).addr;
+    Value result;
+    int thrown = proc_join(p, wk, &result);
+    if(thrown != 0) proc_throw(p, thrown);
+    proc_push(p, result);
+}
+
+// Makes a channel for any number of senders and receivers. Its capacity
+// is rounded up to a power of two, and to at least 2
+// ( capacity -- chan )
+void w_chan_new(Processor *p) {
+    i32 capacity = proc_pop(p).num;
+    proc_push(p, (Value){ .addr = (Value*)chan_new(p, capacity, false) });
+}
+
+// Makes a channel for a single sender and a single receiver, faster
+// ( capacity -- chan )
+void w_chan_new_single(Processor *p) {
+    i32 capacity = proc_pop(p).num;
+    proc_push(p, (Value){ .addr = (Value*)chan_new(p, capacity, true) });
+}
+
+void w_chan_free(Processor *p) {
+    chan_free((Channel*)proc_pop(p).addr);
+}
+
+// ( x chan -- )
+void w_chan_send(Processor *p) {
+    Channel *c = (Channel*)proc_pop(p).addr;
+    Value x = proc_pop(p);
+    chan_send(c, x);
+}
+
+// ( chan -- x )
+void w_chan_recv(Processor *p) {
+    Channel *c = (Channel*)proc_pop(p).addr;
+    proc_push(p, chan_recv(c));
+}
+
+// ( chan -- x true | false )
+void w_chan_try_recv(Processor *p) {
+    Channel *c = (Channel*)proc_pop(p).addr;
+    Value x;
+    bool ok = chan_try_recv(c, &x);
+    if(ok) proc_push(p, x);
+    proc_push(p, (Value){ .num = flag(ok) });
+}
+#endif // BKF_WORKERS
+
+void w_compile(Processor *p) {
+    Value value = proc_pop(p);
+#if BKF_COMPACT
+    // Cells of compact code aren't values, to be compiled by hand
+    if(proc_compile_mode(p))
+        error(p, THROW_argument, "can't compile cells into compact code");
+#endif // BKF_COMPACT
+    proc_comma(p, value);
+    proc_comp_fence(p);
+    p->comp_straight = false;
+    if(p->comp_word != NULL) p->comp_word->flags |= FLAG_raw;
+}
+
+// -----------------------------------------------------------------------------
+
+// Compact code may have left it short of a whole cell, where the next cell
+// allotted goes
+void w_here(Processor *p) {
+    proc_push(p, (Value){ .addr = proc_allot(p, 0) });
+}
+
+void w_allot(Processor *p) {
+    Value n = proc_pop(p);
+    if(n.num < 0) error(p, THROW_argument, "negative allot");
+    proc_allot(p, n.num * sizeof(Value));
+}
+
+// Defines a word that pushes the address of the data space following it.
+// It is a constant of that address, so it is compiled as a literal, which
+// fuses with the @ or ! after it
+void w_create(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_create(p, name, FLAG_code);
+    w->op = OP_constant;
+    w->as.value = (Value){ .addr = proc_allot(p, 0) };
+    w->effect = op_effects[OP_constant];
+}
+
+// Whether a constant is the address of the data space right after its
+// word, as those defined by create are
+bool word_is_created(const Word *w) {
+    size_t size = (sizeof(*w) + w->name_len + 1 + sizeof(Value) - 1)
+        / sizeof(Value) * sizeof(Value);
+    return w->op == OP_constant
+        && (uint8_t*)w->as.value.addr == (uint8_t*)w + size;
+}
+
+// Constants keep their value in their header, and are compiled as literals
+void w_constant(Processor *p) {
+    Value val = proc_pop(p);
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_create(p, name, FLAG_code);
+    w->op = OP_constant;
+    w->as.value = val;
+    w->effect = op_effects[OP_constant];
+}
+
+// Defines a word that forgets itself and every word defined after it
+void w_marker(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_create(p, name, FLAG_code);
+    w->op = OP_marker;
+    w->effect = op_effects[OP_marker];
+}
+
+// ( "name" -- )
+void w_forget(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_find(p, name);
+    if(w == NULL) error_undef(p, name);
+    proc_forget(p, w);
+}
+
+void w_variable(Processor *p) {
+    w_create(p);
+    proc_comma(p, (Value){ .num = 0 });
+}
+
+// Defines a task, with its stacks laid out after it ( "name" -- )
+void w_task(Processor *p) {
+    w_create(p);
+    Task *t = proc_allot(p, sizeof(*t));
+    *t = (Task){ .older = p->tasks, .owner = p };
+    p->tasks = t;
+    stack_place(&t->ds, proc_allot(p, (STACK_GUARD + BKF_TASK_DS_SIZE)
+                * sizeof(Value)), BKF_TASK_DS_SIZE);
+    stack_place(&t->rs, proc_allot(p, (STACK_GUARD + BKF_TASK_RS_DEPTH)
+                * sizeof(Value)), BKF_TASK_RS_DEPTH);
+    stack_place(&t->ls, proc_allot(p, (STACK_GUARD + 2 * BKF_TASK_LS_DEPTH)
+                * sizeof(Value)), 2 * BKF_TASK_LS_DEPTH);
+}
+
+// -----------------------------------------------------------------------------
+
+// Kernels of the words that work on ranges of cells, looking at the number
+// in each one. Like the arithmetic of the inner interpreter, their results
+// wrap around on overflow. The ranges are taken as given, with no checks
+typedef struct kernels {
+    i32 (*sum)(const Value *a, size_t n);
+    i32 (*min)(const Value *a, size_t n); // INT32_MAX for none
+    i32 (*max)(const Value *a, size_t n); // INT32_MIN for none
+    i32 (*dot)(const Value *a, const Value *b, size_t n);
+    void (*add)(Value *a, size_t n, i32 x);
+} Kernels;
+
+i32 cells_sum(const Value *a, size_t n) {
+    uint32_t sum = 0;
+    for(size_t i = 0; i < n; ++i) sum += (uint32_t)a[i].num;
+    return (i32)sum;
+}
+
+i32 cells_min(const Value *a, size_t n) {
+    i32 min = INT32_MAX;
+    for(size_t i = 0; i < n; ++i) if(a[i].num < min) min = a[i].num;
+    return min;
+}
+
+i32 cells_max(const Value *a, size_t n) {
+    i32 max = INT32_MIN;
+    for(size_t i = 0; i < n; ++i) if(a[i].num > max) max = a[i].num;
+    return max;
+}
+
+i32 cells_dot(const Value *a, const Value *b, size_t n) {
+    uint32_t sum = 0;
+    for(size_t i = 0; i < n; ++i)
+        sum += (uint32_t)a[i].num * (uint32_t)b[i].num;
+    return (i32)sum;
+}
+
+void cells_add(Value *a, size_t n, i32 x) {
+    for(size_t i = 0; i < n; ++i)
+        a[i].num = (i32)((uint32_t)a[i].num + (uint32_t)x);
+}
+
+// The vector kernels take cells to be 8 bytes, with the number in the low
+// half, and leave the rest of them alone. On x86-64, the AVX2 ones are used
+// if the CPU has it, and the SSE2 ones, which every x86-64 CPU has, if not.
+// Each kernel does what is left over after the last whole vector with the
+// portable one
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+# define CELLS_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__AARCH64EB__)
+# define CELLS_NEON
+#endif // __x86_64__
+
+#if defined(CELLS_X86) || defined(CELLS_NEON)
+_Static_assert(sizeof(Value) == 8, "vector kernels need 8 byte cells");
+#endif
+
+#ifdef CELLS_X86
+// Vectors of 2 cells, from which only the even 32-bit lanes are kept
+static inline i32 sse2_lanes_sum(__m128i v) {
+    return (i32)((uint32_t)_mm_cvtsi128_si32(v)
+            + (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(v, v)));
+}
+
+static inline __m128i sse2_select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Copies the number of each cell over its high half, so that every lane
+// can be compared
+static inline __m128i sse2_load_nums(const Value *a) {
+    __m128i v = _mm_loadu_si128((const __m128i*)a);
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 0, 0));
+}
+
+i32 sse2_sum(const Value *a, size_t n) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2)
+        sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i*)&a[i]));
+    return (i32)((uint32_t)sse2_lanes_sum(sum)
+            + (uint32_t)cells_sum(&a[i], n - i));
+}
+
+i32 sse2_min(const Value *a, size_t n) {
+    __m128i min = _mm_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i v = sse2_load_nums(&a[i]);
+        min = sse2_select(_mm_cmplt_epi32(v, min), v, min);
+    }
+    i32 lo = _mm_cvtsi128_si32(min);
+    i32 hi = _mm_cvtsi128_si32(_mm_unpackhi_epi64(min, min));
+    i32 rest = cells_min(&a[i], n - i);
+    if(hi < lo) lo = hi;
+    return rest < lo ? rest : lo;
+}
+
+i32 sse2_max(const Value *a, size_t n) {
+    __m128i max = _mm_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i v = sse2_load_nums(&a[i]);
+        max = sse2_select(_mm_cmpgt_epi32(v, max), v, max);
+    }
+    i32 lo = _mm_cvtsi128_si32(max);
+    i32 hi = _mm_cvtsi128_si32(_mm_unpackhi_epi64(max, max));
+    i32 rest = cells_max(&a[i], n - i);
+    if(hi > lo) lo = hi;
+    return rest > lo ? rest : lo;
+}
+
+// The low half of each 64-bit product is the product of the numbers, as it
+// wraps around
+i32 sse2_dot(const Value *a, const Value *b, size_t n) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i*)&b[i]);
+        sum = _mm_add_epi32(sum, _mm_mul_epu32(va, vb));
+    }
+    return (i32)((uint32_t)sse2_lanes_sum(sum)
+            + (uint32_t)cells_dot(&a[i], &b[i], n - i));
+}
+
+void sse2_add(Value *a, size_t n, i32 x) {
+    const __m128i vx = _mm_set_epi32(0, x, 0, x);
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i *v = (__m128i*)&a[i];
+        _mm_storeu_si128(v, _mm_add_epi32(_mm_loadu_si128(v), vx));
+    }
+    cells_add(&a[i], n - i, x);
+}
+
+static const Kernels sse2_kernels = {
+    sse2_sum, sse2_min, sse2_max, sse2_dot, sse2_add
+};
+
+// Vectors of 4 cells, the same way
+# define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline i32 avx2_lanes_sum(__m256i v) {
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(v),
+            _mm256_extracti128_si256(v, 1));
+    return sse2_lanes_sum(half);
+}
+
+AVX2 static inline __m256i avx2_load_nums(const Value *a) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)a);
+    return _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 0, 0));
+}
+
+AVX2 i32 avx2_sum(const Value *a, size_t n) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        sum = _mm256_add_epi32(sum,
+                _mm256_loadu_si256((const __m256i*)&a[i]));
+    return (i32)((uint32_t)avx2_lanes_sum(sum)
+            + (uint32_t)cells_sum(&a[i], n - i));
+}
+
+AVX2 i32 avx2_min(const Value *a, size_t n) {
+    __m256i min = _mm256_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        min = _mm256_min_epi32(min, avx2_load_nums(&a[i]));
+    __m128i half = _mm_min_epi32(_mm256_castsi256_si128(min),
+            _mm256_extracti128_si256(min, 1));
+    half = _mm_min_epi32(half, _mm_unpackhi_epi64(half, half));
+    i32 lo = _mm_cvtsi128_si32(half), rest = cells_min(&a[i], n - i);
+    return rest < lo ? rest : lo;
+}
+
+AVX2 i32 avx2_max(const Value *a, size_t n) {
+    __m256i max = _mm256_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        max = _mm256_max_epi32(max, avx2_load_nums(&a[i]));
+    __m128i half = _mm_max_epi32(_mm256_castsi256_si128(max),
+            _mm256_extracti128_si256(max, 1));
+    half = _mm_max_epi32(half, _mm_unpackhi_epi64(half, half));
+    i32 lo = _mm_cvtsi128_si32(half), rest = cells_max(&a[i], n - i);
+    return rest > lo ? rest : lo;
+}
+
+AVX2 i32 avx2_dot(const Value *a, const Value *b, size_t n) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i*)&b[i]);
+        sum = _mm256_add_epi32(sum, _mm256_mul_epu32(va, vb));
+    }
+    return (i32)((uint32_t)avx2_lanes_sum(sum)
+            + (uint32_t)cells_dot(&a[i], &b[i], n - i));
+}
+
+AVX2 void avx2_add(Value *a, size_t n, i32 x) {
+    const __m256i vx = _mm256_set_epi32(0, x, 0, x, 0, x, 0, x);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i *v = (__m256i*)&a[i];
+        _mm256_storeu_si256(v, _mm256_add_epi32(_mm256_loadu_si256(v), vx));
+    }
+    cells_add(&a[i], n - i, x);
+}
+
+# undef AVX2
+
+static const Kernels avx2_kernels = {
+    avx2_sum, avx2_min, avx2_max, avx2_dot, avx2_add
+};
+#elif defined(CELLS_NEON)
+// Vectors of 4 cells, loaded split into their low and high halves
+i32 neon_sum(const Value *a, size_t n) {
+    int32x4_t sum = vdupq_n_s32(0);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        sum = vaddq_s32(sum, vld2q_s32((const int32_t*)&a[i]).val[0]);
+    return (i32)((uint32_t)vaddvq_s32(sum)
+            + (uint32_t)cells_sum(&a[i], n - i));
+}
+
+i32 neon_min(const Value *a, size_t n) {
+    int32x4_t min = vdupq_n_s32(INT32_MAX);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        min = vminq_s32(min, vld2q_s32((const int32_t*)&a[i]).val[0]);
+    i32 lo = vminvq_s32(min), rest = cells_min(&a[i], n - i);
+    return rest < lo ? rest : lo;
+}
+
+i32 neon_max(const Value *a, size_t n) {
+    int32x4_t max = vdupq_n_s32(INT32_MIN);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        max = vmaxq_s32(max, vld2q_s32((const int32_t*)&a[i]).val[0]);
+    i32 lo = vmaxvq_s32(max), rest = cells_max(&a[i], n - i);
+    return rest > lo ? rest : lo;
+}
+
+i32 neon_dot(const Value *a, const Value *b, size_t n) {
+    int32x4_t sum = vdupq_n_s32(0);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        sum = vmlaq_s32(sum, vld2q_s32((const int32_t*)&a[i]).val[0],
+                vld2q_s32((const int32_t*)&b[i]).val[0]);
+    return (i32)((uint32_t)vaddvq_s32(sum)
+            + (uint32_t)cells_dot(&a[i], &b[i], n - i));
+}
+
+void neon_add(Value *a, size_t n, i32 x) {
+    const int32x4_t vx = vdupq_n_s32(x);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        int32x4x2_t v = vld2q_s32((const int32_t*)&a[i]);
+        v.val[0] = vaddq_s32(v.val[0], vx);
+        vst2q_s32((int32_t*)&a[i], v);
+    }
+    cells_add(&a[i], n - i, x);
+}
+
+static const Kernels neon_kernels = {
+    neon_sum, neon_min, neon_max, neon_dot, neon_add
+};
+#else
+static const Kernels portable_kernels = {
+    cells_sum, cells_min, cells_max, cells_dot, cells_add
+};
+#endif // CELLS_X86
+
+// Picks the fastest kernels that the CPU can run
+const Kernels *kernels_pick(void) {
+#if defined(CELLS_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return &avx2_kernels;
+    return &sse2_kernels;
+#elif defined(CELLS_NEON)
+    return &neon_kernels;
+#else
+    return &portable_kernels;
+#endif // CELLS_X86
+}
+
+// Pops the number of cells in a range
+size_t proc_pop_count(Processor *p) {
+    i32 n = proc_pop(p).num;
+    if(n < 0) error(p, THROW_argument, "negative count");
+    return n;
+}
+
+// Compares the numbers in two ranges of cells, in order, like memcmp
+int cells_compare(const Value *a, size_t na, const Value *b, size_t nb) {
+    for(size_t i = 0; i < na && i < nb; ++i)
+        if(a[i].num != b[i].num) return a[i].num < b[i].num ? -1 : 1;
+    return na < nb ? -1 : na > nb;
+}
+
+// ( addr n x -- )
+void w_fill(Processor *p) {
+    Value x = proc_pop(p);
+    size_t n = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    for(size_t i = 0; i < n; ++i) a[i] = x;
+}
+
+// Copies cells as if through a buffer, so the ranges may overlap
+// ( src dst n -- )
+void w_move(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *dst = proc_pop(p).addr, *src = proc_pop(p).addr;
+    if(n > 0) memmove(dst, src, n * sizeof(Value));
+}
+
+// Copies cells one at a time, from the first on, so a range overlapping the
+// end of the source is filled with copies of its start ( src dst n -- )
+void w_cmove(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *dst = proc_pop(p).addr, *src = proc_pop(p).addr;
+    for(size_t i = 0; i < n; ++i) dst[i] = src[i];
+}
+
+// ( addr1 n1 addr2 n2 -- -1 | 0 | 1 )
+void w_compare(Processor *p) {
+    size_t nb = proc_pop_count(p);
+    Value *b = proc_pop(p).addr;
+    size_t na = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    proc_push(p, (Value){ .num = cells_compare(a, na, b, nb) });
+}
+
+// Looks for the second range in the first, leaving what is left of the first
+// from where it was found, or all of it if it wasn't
+// ( addr1 n1 addr2 n2 -- addr3 n3 flag )
+void w_search(Processor *p) {
+    size_t nb = proc_pop_count(p);
+    Value *b = proc_pop(p).addr;
+    size_t na = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    for(size_t i = 0; nb <= na && i <= na - nb; ++i) {
+        if(cells_compare(&a[i], nb, b, nb) != 0) continue;
+        proc_push(p, (Value){ .addr = &a[i] });
+        proc_push(p, (Value){ .num = na - i });
+        proc_push(p, (Value){ .num = flag(true) });
+        return;
+    }
+    proc_push(p, (Value){ .addr = a });
+    proc_push(p, (Value){ .num = na });
+    proc_push(p, (Value){ .num = flag(false) });
+}
+
+// ( addr n -- x )
+void w_sum(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    proc_push(p, (Value){ .num = p->kernels->sum(a, n) });
+}
+
+// ( addr n -- x )
+void w_min_of(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    proc_push(p, (Value){ .num = p->kernels->min(a, n) });
+}
+
+// ( addr n -- x )
+void w_max_of(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    proc_push(p, (Value){ .num = p->kernels->max(a, n) });
+}
+
+// ( addr1 addr2 n -- x )
+void w_dot(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *b = proc_pop(p).addr, *a = proc_pop(p).addr;
+    proc_push(p, (Value){ .num = p->kernels->dot(a, b, n) });
+}
+
+// Adds x to each cell of a range ( x addr n -- )
+void w_add_cells(Processor *p) {
+    size_t n = proc_pop_count(p);
+    Value *a = proc_pop(p).addr;
+    i32 x = proc_pop(p).num;
+    p->kernels->add(a, n, x);
+}
+
+// -----------------------------------------------------------------------------
+
+void w_print(Processor *p) {
+    Value val = proc_pop(p);
+    out_num(&p->out, val.num);
+}
+
+void w_print_u32(Processor *p) {
+    Value val = proc_pop(p);
+    out_hex(&p->out, val.num);
+}
+
+void w_print_ch(Processor *p) {
+    Value val = proc_pop(p);
+    out_char(&p->out, val.ch);
+}
+
+// Terminals get each line as soon as it ends
+void w_endline(Processor *p) {
+    out_char(&p->out, '\n');
+    if(p->out.tty) out_flush(&p->out);
+}
+
+// Profiling starts or stops the next time the interpreter is entered, so
+// the words being run when it is turned on or off aren't timed halfway
+void w_profile_on(Processor *p) {
+    p->profiling = true;
+}
+
+void w_profile_off(Processor *p) {
+    p->profiling = false;
+}
+
+void w_profile_report(Processor *p) {
+    proc_profile_report(p);
+}
+
+// Like profiling, tracing starts or stops the next time the interpreter is
+// entered. Native code isn't traced, only the calls into it
+void w_trace_on(Processor *p) {
+    p->tracing = true;
+    trace_install(p);
+}
+
+void w_trace_off(Processor *p) {
+    p->tracing = false;
+}
+
+void w_trace_dump(Processor *p) {
+    proc_trace_dump(p);
+}
+
+// Lists the fusion rules applied by the compiler so far
+void w_dump_fusions(Processor *p) {
+    for(int i = 0; i < FUSION_COUNT; ++i) {
+        if(p->fusion_hits[i] == 0) continue;
+        const Fusion *f = &fusions[i];
+        StringView first = word_name(p->prims[f->first]);
+        StringView second = word_name(p->prims[f->second]);
+        StringView fused = word_name(p->prims[f->fused]);
+        out_write(&p->out, first.text, first.len);
+        if(f->zero) out_str(&p->out, " 0");
+        out_char(&p->out, ' ');
+        out_write(&p->out, second.text, second.len);
+        out_str(&p->out, " -> ");
+        out_write(&p->out, fused.text, fused.len);
+        out_char(&p->out, ' ');
+        out_num(&p->out, p->fusion_hits[i]);
+        out_char(&p->out, '\n');
+    }
+}
+
+#ifdef BKF_PAIR_STATS
+int pair_count_cmp(const void *a, const void *b) {
+    uint64_t ca = ((const PairCount*)a)->count;
+    uint64_t cb = ((const PairCount*)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+// Lists the pairs of instructions that ran one after the other the most
+void w_dump_pairs(Processor *p) {
+    PairCount *sorted = get_mem(PAIRS_SIZE * sizeof(*sorted));
+    memcpy(sorted, p->pairs, PAIRS_SIZE * sizeof(*sorted));
+    qsort(sorted, PAIRS_SIZE, sizeof(*sorted), pair_count_cmp);
+    for(int i = 0; i < 20 && sorted[i].count > 0; ++i) {
+        StringView first = word_name(sorted[i].first);
+        StringView second = word_name(sorted[i].second);
+        out_write(&p->out, first.text, first.len);
+        out_char(&p->out, ' ');
+        out_write(&p->out, second.text, second.len);
+        out_char(&p->out, ' ');
+        char count[24];
+        snprintf(count, sizeof(count), "%" PRIu64 "\n", sorted[i].count);
+        out_str(&p->out, count);
+    }
+    free_mem(sorted);
+}
+#endif // BKF_PAIR_STATS
+
+void w_save_image(Processor *p) {
+    if(proc_compile_mode(p))
+        error(p, THROW_nesting, "can't save an image inside a definition");
+    if(p->parent != NULL)
+        error(p, THROW_worker, "workers can't save images");
+    StringView name = scan_word(&p->scan);
+    char *filename = get_mem(name.len + 1);
+    memcpy(filename, name.text, name.len);
+    filename[name.len] = '\0';
+    bool ok = proc_save_image(p, filename);
+    free_mem(filename);
+    if(!ok) error(p, THROW_file, "can't write image");
+}
+
+void w_flush(Processor *p) {
+    out_flush(&p->out);
+}
+
+// Prints the effect of a word, as a stack comment
+void out_effect(Output *out, Effect e) {
+    if(e.in < 0) {
+        out_str(out, "( ? )");
+        return;
+    }
+    out_str(out, "( ");
+    out_num(out, e.in);
+    out_str(out, " -- ");
+    out_num(out, e.out);
+    out_str(out, " ) grows ");
+    out_num(out, e.grow);
+}
+
+void w_effect(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_find(p, name);
+    if(w == NULL) error_undef(p, name);
+    out_effect(&p->out, w->effect);
+    out_char(&p->out, '\n');
+}
+
+// Decompiles a word, one instruction per line
+void w_see(Processor *p) {
+    StringView name = scan_word(&p->scan);
+    Word *w = proc_find(p, name);
+    if(w == NULL) error_undef(p, name);
+    if(w->op == OP_constant || w->op == OP_marker) {
+        if(word_is_created(w)) out_str(&p->out, "create ");
+        else if(w->op == OP_constant) {
+            out_num(&p->out, w->as.value.num);
+            out_str(&p->out, " constant ");
+        } else out_str(&p->out, "marker ");
+        out_str(&p->out, word_name(w).text);
+        out_char(&p->out, '\n');
+        return;
+    }
+    out_str(&p->out, word_is_colon(w) ? ": " : "code ");
+    out_str(&p->out, word_name(w).text);
+    out_char(&p->out, ' ');
+    out_effect(&p->out, w->effect);
+    out_char(&p->out, '\n');
+    int len = word_is_colon(w) ? word_body_len(p, w, (Code*)p->here) : 0;
+    for(int i = 0; i < len; ) {
+        Instr in = code_decode(p, &w->as.body[i]);
+        Word *op = in.xt;
+        out_str(&p->out, "  ");
+        out_str(&p->out, word_name(op).text);
+        if(op_operands[op->op] > 0) {
+            out_char(&p->out, ' ');
+            if(op->op == OP_tail)
+                out_str(&p->out, word_name(in.arg.xt).text);
+            else if(op->op == OP_frame) {
+                out_num(&p->out, in.arg.num >> 8);
+                out_char(&p->out, ' ');
+                out_num(&p->out, in.arg.num & 0xFF);
+            } else out_num(&p->out, in.arg.num);
+        }
+        out_char(&p->out, '\n');
+        i += in.len;
+    }
+    if(word_is_colon(w)) out_str(&p->out, ";\n");
+}
+
+void w_dump_ds(Processor *p) {
+    bool first = true;
+    for(Value *v = p->ds.base; v <= p->ds.sp; ++v) {
+        if(!first) out_char(&p->out, ' ');
+        else first = false;
+        out_num(&p->out, v->num);
+    }
+    if(!first) out_char(&p->out, '\n');
 }
 
 // -----------------------------------------------------------------------------
 
 void load_builtin(Processor *p) {
-    p->w_exit = code_word(p, "exit" , w_exit, 0);
-    p->w_push = code_word(p, "_push", w_push, FLAG_hidden);
-
-    code_word(p, ":"        , w_define    , 0);
-    code_word(p, "'"        , w_quote     , FLAG_immediate);
-    code_word(p, ";"        , w_end       , FLAG_immediate | FLAG_comp_only);
-    code_word(p, ","        , w_compile   , FLAG_immediate | FLAG_comp_only);
-    code_word(p, "immediate", w_immediate , FLAG_immediate | FLAG_comp_only);
-    code_word(p, "constant" , w_constant  , FLAG_immediate);
-    code_word(p, "variable" , w_variable  , 0);
-    code_word(p, "@"        , w_fetch     , 0);
-    code_word(p, "!"        , w_store     , 0);
-    code_word(p, "dup"      , w_dup       , 0);
-    code_word(p, "swap"     , w_swap      , 0);
-    code_word(p, "drop"     , w_drop      , 0);
-    code_word(p, "over"     , w_over      , 0);
-    code_word(p, "rot"      , w_rot       , 0);
-    code_word(p, "."        , w_print     , 0);
-    code_word(p, ".u"       , w_print_u32 , 0);
-    code_word(p, ".c"       , w_print_ch  , 0);
-    code_word(p, "cr"       , w_endline   , 0);
-    code_word(p, ".s"       , w_dump_ds   , 0);
-    code_word(p, "+"        , w_add       , 0);
-    code_word(p, "-"        , w_sub       , 0);
-    code_word(p, "*"        , w_mul       , 0);
-    code_word(p, "/"        , w_div       , 0);
-    code_word(p, "<"        , w_less      , 0);
-    code_word(p, "<="       , w_less_eq   , 0);
-    code_word(p, ">"        , w_greater   , 0);
-    code_word(p, ">="       , w_greater_eq, 0);
-    code_word(p, "="        , w_equals    , 0);
-    code_word(p, "<>"       , w_not_eq    , 0);
-    code_word(p, "and"      , w_and       , 0);
-    code_word(p, "or"       , w_or        , 0);
-    code_word(p, "xor"      , w_xor       , 0);
+    p->w_exit = prim_word(p, "exit" , OP_exit, 0);
+    p->w_push = prim_word(p, "_push", OP_push, FLAG_hidden);
+    p->w_tail = prim_word(p, "_tail", OP_tail, FLAG_hidden);
+
+    code_word(p, ":"        , w_define     , 0);
+    code_word(p, "'"        , w_quote      , FLAG_immediate);
+    prim_word(p, "execute"  , OP_execute   , 0);
+    code_word(p, "catch"    , w_catch      , 0);
+    code_word(p, "throw"    , w_throw      , 0);
+#if BKF_WORKERS
+    code_word(p, "spawn"    , w_spawn      , 0);
+    code_word(p, "join"     , w_join       , 0);
+    code_word(p, "chan-new" , w_chan_new   , 0);
+    code_word(p, "chan-new-single", w_chan_new_single, 0);
+    code_word(p, "chan-free", w_chan_free  , 0);
+    code_word(p, "chan-send", w_chan_send  , 0);
+    code_word(p, "chan-recv", w_chan_recv  , 0);
+    code_word(p, "chan-try-recv", w_chan_try_recv, 0);
+#endif // BKF_WORKERS
+    code_word(p, "\\"       , w_line_comment, FLAG_immediate);
+    code_word(p, "("        , w_comment    , FLAG_immediate);
+    code_word(p, ";"        , w_end        , FLAG_immediate | FLAG_comp_only);
+    code_word(p, ","        , w_compile    , FLAG_immediate);
+    code_word(p, "immediate", w_immediate  , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "recurse"  , w_recurse    , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "{:"       , w_locals     , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "to"       , w_to         , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "inline"   , w_inline     , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "noinline" , w_noinline   , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "constant" , w_constant   , FLAG_immediate);
+    code_word(p, "variable" , w_variable   , 0);
+    code_word(p, "marker"   , w_marker     , 0);
+    code_word(p, "forget"   , w_forget     , 0);
+    code_word(p, "create"   , w_create     , 0);
+    code_word(p, "here"     , w_here       , 0);
+    code_word(p, "allot"    , w_allot      , 0);
+    code_word(p, "fill"     , w_fill       , 0);
+    code_word(p, "move"     , w_move       , 0);
+    code_word(p, "cmove"    , w_cmove      , 0);
+    code_word(p, "compare"  , w_compare    , 0);
+    code_word(p, "search"   , w_search     , 0);
+    code_word(p, "sum"      , w_sum        , 0);
+    code_word(p, "min-of"   , w_min_of     , 0);
+    code_word(p, "max-of"   , w_max_of     , 0);
+    code_word(p, "dot"      , w_dot        , 0);
+    code_word(p, "a+!"      , w_add_cells  , 0);
+    prim_word(p, "@"        , OP_fetch     , 0);
+    prim_word(p, "!"        , OP_store     , 0);
+    prim_word(p, "cells+"   , OP_index     , 0);
+    prim_word(p, "dup"      , OP_dup       , 0);
+    prim_word(p, "swap"     , OP_swap      , 0);
+    prim_word(p, "drop"     , OP_drop      , 0);
+    prim_word(p, "over"     , OP_over      , 0);
+    prim_word(p, "rot"      , OP_rot       , 0);
+    code_word(p, "."        , w_print      , 0);
+    code_word(p, ".u"       , w_print_u32  , 0);
+    code_word(p, ".c"       , w_print_ch   , 0);
+    code_word(p, "cr"       , w_endline    , 0);
+    code_word(p, ".s"       , w_dump_ds    , 0);
+    code_word(p, "flush"    , w_flush      , 0);
+    code_word(p, "save-image", w_save_image, 0);
+    prim_word(p, "+"        , OP_add       , 0);
+    prim_word(p, "-"        , OP_sub       , 0);
+    prim_word(p, "*"        , OP_mul       , 0);
+    prim_word(p, "/"        , OP_div       , 0);
+    prim_word(p, "<"        , OP_less      , 0);
+    prim_word(p, "<="       , OP_less_eq   , 0);
+    prim_word(p, ">"        , OP_greater   , 0);
+    prim_word(p, ">="       , OP_greater_eq, 0);
+    prim_word(p, "="        , OP_equals    , 0);
+    prim_word(p, "<>"       , OP_not_eq    , 0);
+    prim_word(p, "and"      , OP_and       , 0);
+    prim_word(p, "or"       , OP_or        , 0);
+    prim_word(p, "xor"      , OP_xor       , 0);
+
+    prim_word(p, "branch"   , OP_branch    , FLAG_comp_only);
+    prim_word(p, "0branch"  , OP_zero_branch, FLAG_comp_only);
+    prim_word(p, "_do"      , OP_do        , FLAG_hidden);
+    prim_word(p, "_loop"    , OP_loop      , FLAG_hidden);
+    prim_word(p, "_+loop"   , OP_plus_loop , FLAG_hidden);
+    prim_word(p, "i"        , OP_loop_i    , FLAG_comp_only);
+    prim_word(p, "j"        , OP_loop_j    , FLAG_comp_only);
+    prim_word(p, "unloop"   , OP_unloop    , FLAG_comp_only);
+    prim_word(p, "_frame"   , OP_frame     , FLAG_hidden);
+    prim_word(p, "_local@"  , OP_local_fetch, FLAG_hidden);
+    prim_word(p, "_local!"  , OP_local_store, FLAG_hidden);
+    prim_word(p, "_leave"   , OP_leave     , FLAG_hidden);
+    code_word(p, "task"     , w_task       , 0);
+    prim_word(p, "activate" , OP_activate  , FLAG_comp_only);
+    prim_word(p, "pause"    , OP_pause     , 0);
+    prim_word(p, "stop"     , OP_stop      , 0);
+    code_word(p, "if"       , w_if         , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "else"     , w_else       , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "then"     , w_then       , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "begin"    , w_begin      , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "until"    , w_until      , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "again"    , w_again      , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "while"    , w_while      , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "repeat"   , w_repeat     , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "do"       , w_do         , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "loop"     , w_loop       , FLAG_immediate | FLAG_comp_only);
+    code_word(p, "+loop"    , w_plus_loop  , FLAG_immediate | FLAG_comp_only);
+    prim_word(p, "0="       , OP_zero_equals, 0);
+    prim_word(p, "nip"      , OP_nip       , 0);
+    prim_word(p, "2dup"     , OP_two_dup   , 0);
+    code_word(p, ".fusions" , w_dump_fusions, 0);
+    code_word(p, "effect"   , w_effect     , 0);
+    code_word(p, "see"      , w_see        , 0);
+    code_word(p, "profile-on", w_profile_on, 0);
+    code_word(p, "profile-off", w_profile_off, 0);
+    code_word(p, "profile-report", w_profile_report, 0);
+    code_word(p, "trace-on" , w_trace_on   , 0);
+    code_word(p, "trace-off", w_trace_off  , 0);
+    code_word(p, "trace-dump", w_trace_dump, 0);
+#ifdef BKF_PAIR_STATS
+    code_word(p, ".pairs"   , w_dump_pairs , 0);
+#endif // BKF_PAIR_STATS
+
+    // Superinstructions are only compiled by fusion
+    prim_word(p, "_lit+"    , OP_lit_add   , FLAG_hidden);
+    prim_word(p, "_lit-"    , OP_lit_sub   , FLAG_hidden);
+    prim_word(p, "_lit<"    , OP_lit_less  , FLAG_hidden);
+    prim_word(p, "_lit="    , OP_lit_equals, FLAG_hidden);
+    prim_word(p, "_lit@"    , OP_lit_fetch , FLAG_hidden);
+    prim_word(p, "_lit!"    , OP_lit_store , FLAG_hidden);
+    prim_word(p, "_dup@"    , OP_dup_fetch , FLAG_hidden);
+    prim_word(p, "_swap!"   , OP_swap_store, FLAG_hidden);
+    prim_word(p, "_over+"   , OP_over_add  , FLAG_hidden);
+    prim_word(p, "_dup@lit+", OP_dup_fetch_lit_add, FLAG_hidden);
+    prim_word(p, "_lit+!"   , OP_lit_add_store, FLAG_hidden);
+
+    // Effects of the code words that colon words commonly call, which
+    // otherwise would keep them from being analysed
+    proc_find(p, sv_init("."))->effect     = (Effect){ 1, 0, 0 };
+    proc_find(p, sv_init(".u"))->effect    = (Effect){ 1, 0, 0 };
+    proc_find(p, sv_init(".c"))->effect    = (Effect){ 1, 0, 0 };
+    proc_find(p, sv_init("cr"))->effect    = (Effect){ 0, 0, 0 };
+    proc_find(p, sv_init(".s"))->effect    = (Effect){ 0, 0, 0 };
+    proc_find(p, sv_init("flush"))->effect = (Effect){ 0, 0, 0 };
+    proc_find(p, sv_init("here"))->effect  = (Effect){ 0, 1, 1 };
+    proc_find(p, sv_init("fill"))->effect  = (Effect){ 3, 0, 0 };
+    proc_find(p, sv_init("move"))->effect  = (Effect){ 3, 0, 0 };
+    proc_find(p, sv_init("cmove"))->effect = (Effect){ 3, 0, 0 };
+    proc_find(p, sv_init("compare"))->effect = (Effect){ 4, 1, 0 };
+    proc_find(p, sv_init("search"))->effect = (Effect){ 4, 3, 0 };
+    proc_find(p, sv_init("sum"))->effect   = (Effect){ 2, 1, 0 };
+    proc_find(p, sv_init("min-of"))->effect = (Effect){ 2, 1, 0 };
+    proc_find(p, sv_init("max-of"))->effect = (Effect){ 2, 1, 0 };
+    proc_find(p, sv_init("dot"))->effect   = (Effect){ 3, 1, 0 };
+    proc_find(p, sv_init("a+!"))->effect   = (Effect){ 3, 0, 0 };
+#if BKF_WORKERS
+    proc_find(p, sv_init("spawn"))->effect = (Effect){ 2, 1, 0 };
+    proc_find(p, sv_init("join"))->effect  = (Effect){ 1, 1, 0 };
+    proc_find(p, sv_init("chan-send"))->effect = (Effect){ 2, 0, 0 };
+    proc_find(p, sv_init("chan-recv"))->effect = (Effect){ 1, 1, 0 };
+#endif // BKF_WORKERS
 }
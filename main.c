@@ -0,0 +1,193 @@
+/*
+ * Copyright 2025 Eduardo Antunes dos Santos Vieira
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// The command line interface of the interpreter, which is otherwise a
+// library, as declared in bkf.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bkf.h"
+
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [options] [file...]\n"
+            "Runs the files, of which - is the standard input, and the code given\n"
+            "to -e in order and exits, or starts a REPL if there are none\n"
+            "  -d, --data-stack <cells>    capacity of the data stack (default %d)\n"
+            "  -e, --eval <code>           run the code\n"
+            "  -i, --image <file>          start from an image saved by save-image,\n"
+            "                              instead of loading prelude.f\n"
+            "  -j, --jit                   compile the colon words called most often\n"
+            "                              to native code, where supported\n"
+            "  -l, --inline-max <cells>    largest colon word inlined without being\n"
+            "                              marked inline (default %d)\n"
+            "  -m, --dict-size <cells>     size of the dictionary space (default %d)\n"
+            "  -p, --profile               time every word run, and list them at exit\n"
+            "  -q, --quiet                 run the standard input as a whole, without\n"
+            "                              the banner and prompts of the REPL\n"
+            "  -r, --return-stack <cells>  capacity of the R stack, which limits the\n"
+            "                              nesting of colon words (default %d)\n"
+            "  -t, --jit-threshold <calls> calls to a word before the JIT compiles it,\n"
+            "                              which implies --jit (default %d)\n"
+            "  -u, --unbuffered            write output as soon as it is printed\n"
+            "  -x, --trace                 record the last instructions run, to be\n"
+            "                              dumped on errors, trace-dump or SIGUSR1\n",
+            prog, BKF_DS_SIZE, BKF_INLINE_MAX, BKF_DICT_SIZE, BKF_RS_DEPTH,
+            BKF_JIT_THRESHOLD);
+    exit(1);
+}
+
+// Reads the size given to an option, which must be positive
+int option_size(int argc, char **argv, int *i) {
+    if(*i + 1 >= argc) usage(argv[0]);
+    char *end;
+    long n = strtol(argv[++*i], &end, 10);
+    if(*end != '\0' || n <= 0 || n > INT32_MAX / 16) usage(argv[0]);
+    return n;
+}
+
+bool option_is(const char *arg, const char *short_name, const char *long_name) {
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+// A file or a piece of code from the command line, to be run in order
+typedef struct {
+    const char *text;
+    bool is_code;
+} Script;
+
+bool run_script(BkfProcessor *p, Script script) {
+    if(script.is_code) return bkf_eval(p, script.text);
+    if(strcmp(script.text, "-") == 0) return bkf_eval_stream(p, stdin);
+    FILE *fp = fopen(script.text, "rb");
+    if(fp == NULL) {
+        bkf_flush(p);
+        fprintf(stderr, "can't open file %s\n", script.text);
+        return false;
+    }
+    bool ok = bkf_eval_stream(p, fp);
+    fclose(fp);
+    return ok;
+}
+
+// Reads a line, however long, into a buffer grown as needed. Returns its
+// length, or -1 at the end of the file
+int read_line(FILE *fp, char **buf, int *cap) {
+    int len = 0;
+    while(true) {
+        if(*cap - len < 2) {
+            *cap = *cap == 0 ? 256 : *cap * 2;
+            char *grown = realloc(*buf, *cap);
+            if(grown == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(64);
+            }
+            *buf = grown;
+        }
+        if(fgets(&(*buf)[len], *cap - len, fp) == NULL)
+            return len == 0 ? -1 : len;
+        len += strlen(&(*buf)[len]);
+        if((*buf)[len - 1] == '\n') return len;
+    }
+}
+
+void repl(BkfProcessor *p) {
+    bkf_print(p, "blackknifeforth " BKF_VERSION
+            "  Copyright (C) 2025 Eduardo Antunes\n");
+    char *buf = NULL;
+    int cap = 0;
+    while(true) {
+        bkf_print(p, "> ");
+        bkf_flush(p);
+        if(read_line(stdin, &buf, &cap) < 0) break;
+        if(bkf_eval(p, buf)) bkf_print(p, " ok\n");
+    }
+    free(buf);
+    bkf_print(p, "\n");
+    bkf_flush(p);
+}
+
+int main(int argc, char **argv) {
+    BkfConfig config = { .prelude = "prelude.f" };
+    bool quiet = false;
+    Script *scripts = malloc(argc * sizeof(*scripts));
+    if(scripts == NULL) return 64;
+    int script_count = 0;
+    for(int i = 1; i < argc; ++i) {
+        if(option_is(argv[i], "-d", "--data-stack"))
+            config.ds_size = option_size(argc, argv, &i);
+        else if(option_is(argv[i], "-e", "--eval")) {
+            if(i + 1 >= argc) usage(argv[0]);
+            scripts[script_count++] = (Script){
+                .text = argv[++i], .is_code = true
+            };
+        }
+        else if(option_is(argv[i], "-i", "--image")) {
+            if(i + 1 >= argc) usage(argv[0]);
+            config.image = argv[++i];
+        }
+        else if(option_is(argv[i], "-j", "--jit")) {
+            if(config.jit_threshold == 0)
+                config.jit_threshold = BKF_JIT_THRESHOLD;
+        }
+        else if(option_is(argv[i], "-t", "--jit-threshold"))
+            config.jit_threshold = option_size(argc, argv, &i);
+        else if(option_is(argv[i], "-l", "--inline-max"))
+            config.inline_max = option_size(argc, argv, &i);
+        else if(option_is(argv[i], "-m", "--dict-size"))
+            config.dict_size = option_size(argc, argv, &i);
+        else if(option_is(argv[i], "-p", "--profile"))
+            config.profile = true;
+        else if(option_is(argv[i], "-q", "--quiet"))
+            quiet = true;
+        else if(option_is(argv[i], "-r", "--return-stack"))
+            config.rs_size = option_size(argc, argv, &i);
+        else if(option_is(argv[i], "-u", "--unbuffered"))
+            config.unbuffered = true;
+        else if(option_is(argv[i], "-x", "--trace"))
+            config.trace = true;
+        else if(argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+            scripts[script_count++] = (Script){
+                .text = argv[i], .is_code = false
+            };
+        else usage(argv[0]);
+    }
+    if(config.jit_threshold > 0 && !bkf_has_jit())
+        fprintf(stderr, "warning: no JIT for this platform, words will be"
+                " interpreted\n");
+
+    BkfProcessor *bkf = bkf_new(&config);
+    if(bkf == NULL) {
+        free(scripts);
+        return 1;
+    }
+    bool ok = true;
+    for(int i = 0; i < script_count && ok; ++i)
+        ok = run_script(bkf, scripts[i]);
+    if(script_count == 0) {
+        if(quiet) ok = bkf_eval_stream(bkf, stdin);
+        else repl(bkf);
+    }
+    bkf_flush(bkf);
+    free(scripts);
+
+    if(config.profile) bkf_profile_report(bkf);
+    // Freeing the processor waits for its workers, which after an error may
+    // never finish, so a failed run exits with them still running
+    if(!ok) exit(1);
+    bkf_free(bkf);
+    return 0;
+}